@@ -8,10 +8,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include "dropper.h"
 
 #define DEBUG 0
 #define IDQS /* Iteratively deepening QS */
 #define LMR 2
+#define ASPIRATION 50 /* half-width of root window around score of previous iteration */
+#define QS_SELF_GAIN 650 /* in-hand value a self-capture must bring above alpha to be searched in QS */
 
 #define ON  1
 #define OFF 0
@@ -36,7 +40,7 @@
 
 typedef long long int Key;
 
-int ply, nodeCount, forceMove, choice, rootMove, lastGameMove, rootScore, abortFlag, postThinking=1; // some frequently used data
+int ply, nodeCount, qsCount, forceMove, choice, rootMove, lastGameMove, rootScore, abortFlag, postThinking=1; // some frequently used data
 int maxDepth=MAXPLY-2, timeControl=3000, mps=40, inc, timePerMove, timeLeft=1000; // TC parameters
 
 #define H_LOWER 1
@@ -45,8 +49,18 @@ int maxDepth=MAXPLY-2, timeControl=3000, mps=40, inc, timePerMove, timeLeft=1000
 int ReadClock (int start);
 char *MoveToText (int move);
 int TimeIsUp (int mode);
+void ReportPV (int depth, int score, int *pv);
+void SetRootScore (int score);
+int XboardScore (int score);
+int InputPending ();
 
 int randomize, ranKey;
+int xboard;              // set when talking to a GUI, rather than embedded as a library
+DropperInfo *infoHook;   // where the search reports root PVs
+void *infoClosure;
+int workerMode;          // serving a distributed search: input during search means stop
+int rootOnly;            // the one root move a worker searches
+int variantNr;
 int moveNr;              // part of game state; incremented by MakeMove
 
 #define captCode (rawInts + 22*10 + 10)
@@ -64,18 +78,53 @@ int moveNr;              // part of game state; incremented by MakeMove
 #define location (rawLocation + 23)
 #define promoGain (rawGain + 1)
 
+// piece lists, indexed by SIDE(color); removal moves the last entry into the hole
+#define SIDE(C) ((C) >> 6 & 1)
+#define ADD_PIECE(S, X)     (listIndex[X] = pieceCount[S], pieceList[S][pieceCount[S]++] = (X))
+#define DEL_PIECE(S, X)     (pieceList[S][listIndex[X]] = pieceList[S][--pieceCount[S]], listIndex[pieceList[S][listIndex[X]]] = listIndex[X])
+#define MOVE_PIECE(S, X, Y) (pieceList[S][listIndex[Y] = listIndex[X]] = (Y))
+
+// summary of the holdings: bit i (white) or 16+i (black) is set when piece type i is in hand
+#define HAND_BIT(P) (1 << ((P) & 31) + 16*SIDE(P))
+#define HAND(S) (handBits >> 16*SIDE(S) & 0xFFFF)
+
 int pvStack[MAXPLY*MAXPLY/2];
 int nrRanks, nrFiles, specials, pinCodes, maxDrop, moveSP, pawn, queen, lanceMask, *pvPtr = pvStack, boardEnd, perpLoses, searchNr;
 int  frontier, killZone, impasse, frontierPenalty, killPenalty;
+int specialized; // variant is crazyhouse, so the search can use its ZH instance
 int rawInts[21*22], pieceValues[96], pieceCode[96];
+int contactVec[64], slideVec[32]; // vectors for which some piece could attack from adjacent or distant, 0-terminated
+int checkStart[64][22*11+1];      // per piece and King square, where its list of checking squares starts in checkSqr[]
+unsigned char checkSqr[1<<18], checkSkip[1<<18]; // the squares, ray by ray, and how many are left on the ray after each
 signed char   rawChar[32*22], steps[512];
 unsigned char rawByte[102*22], firstDir[64], rawBulk[98], handSlot[97], handSlotSame[97], promoCode[96], aVal[64], vVal[64], rawLocation[96+23], handBulk[96];
 long long int handKey[96], handKeySame[96], pawnKey;
 int handVal[96], handValSame[96], rawGain[97];
+unsigned char pieceList[2][128], listIndex[22*11]; // squares of the pieces of each side (white first), and where in its list a square is
+int pieceCount[2];
+unsigned int handBits;
+
+typedef struct { // what capturing a piece does to the holdings; self-captures keep the color, others flip it
+    Key key;          // hash-key change for the counter
+    int val;          // eval gain of having it in hand
+    unsigned int bit; // handBits bit of the type in hand
+    int slot;         // holdings counter it goes to
+} Transfer;
+
+Transfer transfer[2][96]; // indexed by SIDE of the capturer and victim
 unsigned int moveStack[500*MAXPLY];
+unsigned char unsearched[500*MAXPLY]; // marks pruned quiet drops in moveStack, which get no history penalty
 int killers[MAXPLY][2];
 int path[MAXPLY], deprec[MAXPLY];
+Key pathKey[MAXPLY];            // hash keys of the positions on the current branch, by ply
 int history[1<<16], mateKillers[1<<17];
+unsigned char lmrTable[32][64]; // late-move reduction by remaining depth and number of late move
+int dropHistory[97][22*11];     // success of quiet drops, by dropped piece (+1) and to-square
+
+#define DROPHIST(M) dropHistory[dropType[(M) >> 8 & 255]][(M) & 255]
+#define DROP_CAP(D) (16 + 8*(D)*(D)) /* maximum number of quiet drops searched per node */
+
+static int futilityMargin[] = { 0, 150, 350 }; // by remaining depth; added to the eval gain of the move itself
 int anaSP;
 unsigned char checkHist[MAXMOVES+MAXPLY];
 int repKey[512+100];
@@ -186,7 +235,7 @@ shogiCodes[] = { 21,23,0, -21,-23,0, 22,0, -22,0, 1,-1,0, 43,45,0, -43,-45,0, 42
 void
 InitCaptureCodes(signed char *codes)
 {
-    int i, piece, dir=0;
+    int i, n, piece, dir=0;
     for(i=-10-10*22; i<=10+10*22; i++) captCode[i] = 0; // clear capture codes and step vectors
     // build variant-specific alignment map, marking each square with the capture sets to which it belongs
     for(i=0; i<16; i++) { // for all 16 capture sets
@@ -225,6 +274,43 @@ InitCaptureCodes(signed char *codes)
 	}
 #endif
     }
+    // list the vectors SquareAttacked has to look along
+    for(i=-10-10*22, n=0; i<=10+10*22; i++) if(captCode[i] & C_CONTACT) contactVec[n++] = i;
+    contactVec[n] = 0;
+    for(i=dir=n=0; i<16; i++) { // slide steps of capture sets 8-15, without duplicates
+	int step, j;
+	while((step = codes[dir++])) if(i >= 8) {
+	    for(j=0; j<n && slideVec[j] != step; j++) {}
+	    if(j == n) slideVec[n++] = step;
+	}
+    }
+    slideVec[n] = 0;
+}
+
+void
+InitCheckSquares ()
+{   // tabulate, for every piece that can be dropped and every King square, the squares from which it would check
+    int i, color, k, n = 0;
+    for(color=WHITE; color<=BLACK; color+=WHITE) for(i=0; i<64-WHITE; i++) {
+	int piece = color + i;
+	for(k=0; k<=22*11; k++) {
+	    checkStart[piece-WHITE][k] = n;
+	    if(i <= maxDrop && k < boardEnd && sqr2file[k] < nrFiles) {
+		int step, dir = 2*firstDir[piece-WHITE];
+		while((step = steps[dir++])) { // same walk as MoveGen would make from the King, in opposit direction
+		    int to = k, range = steps[dir++], first = n;
+		    if((range & 3) == 2) continue; // non-capture direction
+		    while((to -= step) >= 0 && to < boardEnd && sqr2file[to] < nrFiles) {
+			if((range -= 8) <= 0 && i == 0 && (to < 22 || to >= boardEnd-22)) break; // no Pawn drop on first or last rank
+			if(n == sizeof(checkSqr)) { printf("tellusererror check-square table overflow\n"); exit(1); }
+			checkSqr[n++] = to;
+			if(range <= 0) break;
+		    }
+		    while(first < n) checkSkip[first] = n - 1 - first, first++; // if a square is occupied, the rest of its ray is blocked
+		}
+	    }
+	}
+    }
 }
 
 /*
@@ -398,6 +484,8 @@ signed char *rawPST[COLOR+1]; // PST[-1...95] indexed by 'mutation', which is -1
 unsigned int rawKey[COLOR+1];
 unsigned int squareKey[22*11];
 
+#define KEY(A, B) (pieceKey[A]*(Key) squareKey[B])
+
 // piece-square tables. White and black tables interleave. The first two pairs are (0, center) and (hand1, ???)
 #define center   (pstData + 22*11)
 #define hand1    (pstData + 22*11)    /* beware: uses off-board part only */
@@ -433,8 +521,8 @@ EngineInit ()
     for(r=WHITE; r<COLOR; r++) pieceKey[r] = MyRandom();
     // for drops the from-key will be pieceKey[-1]*squareKey[typeLocation]
     pieceKey[-1] = MyRandom() << 16; // clear lowest 16 bits to make sure lowest 32 of product are zero
+    for(r=1; r<32; r++) for(f=1; f<64; f++) lmrTable[r][f] = 0.5 + log(r)*log(f)/2.25; // grows slowly with both
     PST[0] = pstData; PST[-1] = hand1; // PST for empty squares
-printf("init done\n");
 }
 
 void
@@ -446,6 +534,8 @@ ClearBoard ()
     for(f=0; f<11; f++) pawnCount[f] = 0xF0;      // Pawn occupancy per file
     for(i=0; i<512+100; i++) repKey[i] = 0;        // game-history hash
     promoGain[WHITE+30] = promoGain[BLACK+30] = 0;// danger measure of in-hand pieces
+    pieceCount[0] = pieceCount[1] = 0;            // piece lists
+    handBits = 0;                                 // empty holdings
 }
 
 char *pieces, *startPos;
@@ -471,8 +561,10 @@ GameInit (char *name)
     codes   = variants[v].proms;
     lanceMask = lances[v];
     perpLoses = v; // this works for now, as only zh allows perpetuals
+    specialized = (v == 0);
+    variantNr = v;
 
-    if((p = betza[v])) { // configure GUI for this variant
+    if((p = betza[v]) && xboard) { // configure GUI for this variant
 	printf("setup (%s) %dx%d+%d_%s %s 0 1", ptc[v], nrFiles, nrRanks, maxDrop+1, (v == 4 ? "chu" : "shogi"), startPos);
 	while(*p) { if(*p == ',') printf("\npiece "); else printf("%c", *p); p++; }
 	printf("\n");
@@ -553,9 +645,9 @@ GameInit (char *name)
     for(f=0; f<97; f++) if(handSlotSame[f] == 0) handSlotSame[f] = 11*21 + 4;
     for(f=WHITE; f<COLOR; f++) { // all pieces
 	r = handSlot[f];         // location in holdings where piece goes (flipped color)
-	handKey[f] = pieceKey[-1]*squareKey[r];
+	handKey[f] = KEY(-1, r); // 64-bit product: the 32-bit one has all bits zero
 	r = handSlotSame[f];     // location in holdings for same-color captures
-	handKeySame[f] = pieceKey[-1]*squareKey[r];
+	handKeySame[f] = KEY(-1, r);
     }
 
     // move-generation tables
@@ -596,7 +688,6 @@ GameInit (char *name)
     // For same-color captures, piece doesn't flip color, so gain is just in-hand bonus
     // Initialize all handValSame to 0 first
     for(i=0; i<96; i++) handValSame[i] = 0;
-    for(i=0; i<96; i++) handKeySame[i] = 0;
     for(i=0, ip=variants[v].values; *ip >= 0; ip++); ip++; // skip to promoted values
     for(; *ip >= 0; ip++); ip++; // skip to in-hand values
     for(i=0; *ip >= 0; i++) {
@@ -614,6 +705,14 @@ GameInit (char *name)
 	promoGain[WHITE+i+16] = promoGain[BLACK+i+16] = pieceValues[WHITE+i+16] - pieceValues[demoted];
     }
     for(i=WHITE; i<COLOR; i++) vVal[i-WHITE] = (handVal[i] + pieceValues[i])/16, aVal[i-WHITE] = handVal[i]/64;
+    for(color=0; color<2; color++) for(i=0; i<96; i++) { // capture transitions, for a capturer of either color
+	Transfer *t = &transfer[color][i];
+	int same = (i >= WHITE && SIDE(i) == color);
+	t->slot = (same ? handSlotSame[i] : handSlot[i]);
+	t->key  = (same ? handKeySame[i]  : handKey[i]);
+	t->val  = (same ? handValSame[i]  : handVal[i]);
+	t->bit  = (i >= WHITE ? HAND_BIT(dropType[t->slot] - 1) : 0);
+    }
     promoGain[WHITE+31] = promoGain[BLACK+31] = 0; // King counts as unpromoted (to make castling work, where it promotes to unpromoted Rook)
 
     // piece-square table
@@ -655,6 +754,7 @@ GameInit (char *name)
     for(f=0,p=pstType[v]; *p; p++,f++) if(*p == ' ') f = 15; else  PST[BLACK+f] = (PST[WHITE+f] = pstData + 22*11*(*p - '0')) + 11*(*p > '2'); 
 
     InitCaptureCodes(variants[v].codes);
+    InitCheckSquares();
     pinCodes = (v == TORI_NR ? 0xFF2C : 0xFF1F); // rays along which pinning is possible
 }
 
@@ -718,9 +818,7 @@ Debug ()
     PrintDBoard("board:", board, "   ", 11);
 }
 
-#define KEY(A, B) (pieceKey[A]*(Key) squareKey[B])
-
-typedef struct { // 12 bytes
+typedef struct { // 16 bytes: lock and three words of data
     unsigned int lock;
     short int score, lim;
     unsigned short int move;
@@ -730,797 +828,210 @@ typedef struct { // 12 bytes
     char age[3];
 } HashEntry;
 
-typedef struct {
+typedef struct { // 12 bytes; QS entries need no flags or aging, and are always replaced
+    unsigned int lock;
+    short int score, lim;
+    unsigned short int move;
+    unsigned char depth;
+    unsigned char checker;
+} QSEntry;
+
+#define QS_HASH (1<<16) /* entries in the QS table: 768KB, small enough to stay in L2 */
+
+typedef struct { // 64 bytes: fields used by every MakeMove/UnMake and daughter first, the rest packed behind them
     Key hashKey, newKey;
+    int pstEval, newEval;
+    int lim;         // for returning upper end of score interval
+    int move, wholeMove;
+    short int depth, bulk;
     unsigned char fromSqr, toSqr, captSqr, epSqr, rookSqr, rights;
     signed char fromPiece, toPiece, victim, savePiece, rook, mutation;
-    int pstEval, newEval, bulk, tpGain;
-    int move, wholeMove, depth;
-    int checker, checkDir, checkDist, xking;
-    int lim; // for returning upper end of score interval
+    unsigned char checker, checkDist, xking; // cold: in-check info, only used for evasions
+    signed char checkDir;
+    int tpGain;                              // cold: only used in QS after a check
 } StackFrame;
 
-typedef struct {   // move stack sectioning
+typedef struct {   // move stack sectioning (40 bytes)
     int firstMove; // start of move list for current ply
     int unsorted;  // start of unsorted tail of move list
     int nonCapts;  // index of first non-capture in move list
     int drops;     // index of first quiet drop
-    int stage;     // stage of move generation (0=hash/capt/prom, 1=killer/noncapt, 2=check-drops, 3=quiet drops)
+    int quiet;     // index of first non-checking drop
     int late;      // start of late moves
     int castlings; // end of list of board moves without castlings
-    int epSqr;
-    int checker;
-    int safety, cBonus, hole, escape;
+    unsigned char stage; // stage of move generation (0=hash/capt/prom, 1=killer/noncapt, 2=check-drops, 3=quiet drops)
+    unsigned char epSqr;
+    signed char safety, cBonus, hole, escape; // cold: King-safety counts for the QS bonus
 } MoveStack;
 
 HashEntry *hashTable;
 Key hashKey, pawnKey;
-int hashMask;
+Key hashMask;      // 64 bits, so the table can exceed 2G entries
+size_t hashBytes;  // size of the mapping holding the table
+int hashMB;        // size asked for
+char sharedName[64]; // named shared-memory object to map the table from, or empty for a private table
+int sharedHash;    // table is mapped from sharedName, and other processes can write it
+QSEntry qsTable[QS_HASH]; // QS nodes only, so they do not evict deeper results from hashTable
 
 static int rightsScore[] = { 0, -10, 10, 0, -10, -30, 0, -20, 10, 0, 30, 20, 0, -20, 20, 0 };
 
-int
-Evaluate (int stm, int rights)
-{
-    static int rays[] = {1, -1, 22, -22, 23, -23, 21, -21 };
-    int k, f, s, score = 0, w, b;
-    k = location[WHITE+31]; s = (k >= 1*22)*6 + 1;
-    score += ((board[k+22] == WHITE) + ((board[k+22+1] == WHITE) + (board[k+22-1] == WHITE) - 2)*s)*2;
-    score += (!board[k+1] + !board[k-1])*(board[k+22] != BLACK)*5;
-    score -= (2*(board[k+22] == BLACK) + (board[k+44] == BLACK) + (board[k+44+1] == BLACK) + (board[k+44-1] == BLACK))*5;
-    for(f=w=0; f<8; f++) { // mark squares from which 
-	int v = rays[f], x = k + v;
-	if(!board[x]) while(!board[x+=v]) w++;
-    }
-    if(k >= killZone) score -= 100;
-    k = location[BLACK+31]; s = (k < boardEnd - 1*22)*6 + 1;
-    score -= ((board[k-22] == BLACK) + ((board[k-22+1] == BLACK) + (board[k-22-1] == BLACK) - 2)*s)*2;
-    score -= (!board[k+1] + !board[k-1])*(board[k-22] != WHITE)*5;
-    score += (2*(board[k-22] == WHITE) + (board[k-44] == WHITE) + (board[k-44+1] == WHITE) + (board[k-44-1] == WHITE))*5;
-    for(f=b=0; f<8; f++) { // mark squares from which 
-	int v = rays[f], x = k + v;
-	if(!board[x]) while(!board[x+=v]) b++;
-    }
-    if(k < boardEnd - killZone) score += 100;
-    score *= 5;
-    score -= ((board[   0] == WHITE+3 && board[0*22+1] && board[1*22]) + (board[     7] == WHITE+3 && board[     6] && board[1*22+7]))*25;
-    score += ((board[7*22] == BLACK+3 && board[7*22+1] && board[6*22]) + (board[7*22+7] == BLACK+3 && board[7*22+6] && board[6*22+7]))*25;
-    score -= ((board[     2] == WHITE+2 && board[1*22+1] && board[1*22+3]) + (board[     5] == WHITE+2 && board[1*22+6] && board[1*22+4]))*15;
-    score += ((board[7*22+2] == BLACK+2 && board[6*22+1] && board[6*22+3]) + (board[7*22+5] == BLACK+2 && board[6*22+6] && board[6*22+4]))*15;
-    score += rightsScore[rights];
-    return stm == WHITE ? score + 15*b - 9*w : -score - 15*w + 9*b;
-}
-
-int
-PseudoLegal (int stm, int move)
-{   // used for testing killers, so we can assume the move must be pseudo-legal for the stm in some position
-    int match, from = move >> 8 & 0xFF, to = move & 255;
-    signed char piece = board[from], mover = move >> 16 & 0xFF;
-    to = toDecode[to]; // could be double-push or castling, though
-    if(board[to]) return 0;
-    if(piece < 0) { // drop
-	if(piece == -1) return 0; // type not in hand
-	piece = dropType[from] - 1;
-	if(!(piece & stm)) return 0; // piece has wrong color
-        if((piece & ~COLOR) == 0 && pawnCount[sqr2file[to]] & maxBulk[stm]) return 0; // Pawn drop would over-crowd file
-	return (board[to] == 0); // otherwise drop is legal on empty square (assumes drop location always legal for piece type)
-    }
-    if(!(piece & stm)) return 0; // piece has wrong color
-    if(piece == stm) { /// Pawn
-	if(stm == WHITE) return board[from+22] == 0 && (to - from == 22 || zoneTab[from] & 0x80 && to - from == 44 && board[to] == 0);
-	return board[from-22] == 0 && (to - from == -22 || zoneTab[from] & 0x80 && to - from == -44 && board[to] == 0);
-    }
-    match = pieceCode[piece] & captCode[to - from];
-    if(!match) return 0; // not aligned
-    if(match & C_DISTANT) { // distant alignment
-	int step = deltaVec[to - from];
-	while(board[to -= step] == 0) {}   // ray scan towards mover
-	return (from == to);               // legal if it reaches mover        
-    } else if((move & 255) > specials) return 0; // must be castling, as Pawns were already taken care of. Forbid for now.
-    return 1; // must be leaper alignment, which guarantees hit
-}
-
 void
 Dump (char *s)
 {int i; printf("%s\n",s); for(i=0; i<ply; i++) printf(" {%x} %s", deprec[i], MoveToText(path[i])); PrintDBoard("board", board, "   ", 11); exit(1); }
 
-#define attacks (rawAttacks + 23)
-static int attackKey, rawAttacks[13*22];
+#define attacks (rawAttacks + 2*22 + 2)
+static int attackKey, rawAttacks[16*22];
+#define pinKey  (rawPinKey + 2*22 + 2)
+#define pinStep (rawPinStep + 2*22 + 2)
+static int rawPinKey[16*22], rawPinStep[16*22]; // our pieces pinned to our King (when pinKey equals attackKey) and the ray they are on
 int depthLimit = MAXPLY;
 
-int
-MoveGen (int stm, MoveStack *m, int castle)
-{   // generate all board moves, return 1 if King capture found amongst those
-    int r, f, c = ++attackKey;
-    m->firstMove = m->nonCapts =  m->late = moveSP; m->stage = 0;
-    for(r=0; r<boardEnd; r+=22) for(f=0; f<nrFiles; f++) {
-	int from = r + f, piece = board[from];
-	if(piece & stm) {
-	    int step, dir = 2*firstDir[piece-WHITE]; // steps data comes in pairs
-	    while((step = steps[dir++])){ // next direction
-		int range = steps[dir++], to = from, victim, inZone = zoneTab[from], d = c - (range == 11);
-		do {
-		    int move, promote, slot;
-		    victim = board[to += step];
-		    attacks[to] = d; // keep track of attacked squares (even with own piece)
-		    if((victim & stm) && (victim & ~COLOR) == 31) break; // cannot capture own King
-		    // Allow capturing own pieces (except King)
-		    if(range & 2) { // divergent move: must be FIDE Pawn
-			if(to == m->epSqr) { // reaches e.p. square: must be through diagonal move, and e.p. square is always empty
-			    moveStack[--m->firstMove] = to + 4*22+11 + 44*(stm == BLACK) | from << 8 | vVal[0] << 24;
-			    break;
-			}
-			if(!victim == (range & 1)) break; // wrong type (lsb set = capture only, cleared = move only)
-			if(range > 7) { // can do double push
-			    if(inZone & Z_DOUBLE && board[to+step] == 0) {   // started on Pawn rank, and square in front of it is empty
-				moveStack[moveSP++] = from << 8 | to + step + 22*5; // generate now, as special move
-			    }
-			    range -= 8; // make sure it is not done again
-			}
-		    }
-		    if((victim & ~COLOR) == 31) return 1; // captures King; abort!
-		    move = piece << 16;   // store piece in move
-		    promote = (inZone | zoneTab[to]) & promoCode[piece-WHITE];
-		    if((promote & ((Z_2ND | Z_MUST ) & ~COLOR)) == 0) { // not in place where deferral forbidden
-			int slot;
-			if(victim) { // capture
-			    slot = --m->firstMove;
-			    move += vVal[victim-WHITE] - aVal[piece-WHITE] << 24; // MVV/LVA sort code
-			} else { // non-capture
-			    slot = moveSP++;
-			}
-			moveStack[slot] = move | from << 8 | to;
-		    }
-		    if(promote & stm) { // promotion is (also?) possible
-			moveStack[--m->firstMove] = (move | from << 8 | to + 11) + (vVal[victim-WHITE] + 20 << 24); // put it amongst captures
-			if(!perpLoses) { // only for FIDE Pawns
-			    moveStack[--m->firstMove] = move | from << 8 | to - 11 + (stm >> 6)*44; // turn previously-generated deferral into under-promotion
-			    // other under-promotions could go here (Capahouse?)
-			}
-		    }
-		    
-		    
-		    if((range -= 8) <= 0) break; // range exhausted
-		} while(!victim);
-	
-	    }
-	}
-    }
-
-    r = location[stm+31]; m->castlings = moveSP; f = 0;
-    if(!(stm >> 5 & castle)) { // K-side castling
-	f++;
-	if(board[r+1] == 0 && board[r+2] == 0) f += 2, moveStack[moveSP++] = r << 8 | 8*22+10 + 22*(stm == BLACK);
-    }
-    if(!(stm >> 3 & castle)) { // Q-side castling
-	f++;
-	if(board[r-1] == 0 && board[r-2] == 0 && board[r-3] == 0) f += 2, moveStack[moveSP++] = r << 8 | 8*22+21 + 22*(stm == BLACK);
-    }
-    m->cBonus = f;
-
-    r = location[stm+31^COLOR]; // enemy King
-#   define HOLE(X) (attacks[X] == c)*!board[X]
-    m->hole = HOLE(r+1) + HOLE(r-1) + HOLE(r+22) + HOLE(r+21) + HOLE(r+23) + HOLE(r-21) + HOLE(r-22) + HOLE(r-23);
-#   define SAFE(X) (attacks[X] == c)*!(board[X] & stm)
-    m->safety = SAFE(r+1) + SAFE(r-1) + SAFE(r+22) + SAFE(r+21) + SAFE(r+23) + SAFE(r-21) + SAFE(r-22) + SAFE(r-23);
-#   define ESC(X) (board[X] & stm || attacks[X] == c)
-    m->escape = 8 - (ESC(r+1) + ESC(r-1) + ESC(r+22) + ESC(r+21) + ESC(r+23) + ESC(r-21) + ESC(r-22) + ESC(r-23));
-    if(stm == WHITE) r = boardEnd - 1 - r;
-    m->safety += (r >= 1*22) + frontierPenalty*(r >= frontier) + killPenalty*(r >= killZone) - 5*(r >= impasse);
-    m->unsorted = m->firstMove; m->drops = moveSP;
-    return 0;
-}
-
-void
-CheckDrops (int stm, int king)
-{
-    int i, lowest = 0;
-    if(perpLoses) lowest = !!(pawnCount[sqr2file[king]] & maxBulk[stm]); // in Shogi no Pawn if file already crowded with those
-    else lowest = (stm == WHITE ? king < 2*22 : king >= 6*22);           // in zh no Pawn from back rank
-    for(i=maxDrop; i>=lowest; i--) {
-	int piece = stm + i, from = handSlot[piece^COLOR];
-	if((signed char)board[from] < -1) { // piece type is in hand
-	    int step, dir = 2*firstDir[piece-WHITE];
-	    while((step = steps[dir++])) {
-		int to = king, range = steps[dir++];
-		if((range & 3) == 2) continue; // non-capture direction
-		while(board[to-=step] == 0) {
-		    moveStack[moveSP++] = to | from << 8;
-		    if((range -= 8) <= 0) { if(i == 0 && (to < 22 || to >= boardEnd-22)) moveSP--; break; }
-		}
-	    }
-	}
-    }
-}
+#define PATH 0
 
-void
-EvasionDrops (int stm, StackFrame *f, int mask)
-{
-    int i, x = f->checker, v = f->checkDir, s = stm ^ COLOR;
-    while(board[x+=v] == 0) { // all squares on check ray
-	int last = maxDrop;
-	if((mask >>= 1) & 1) continue; // suppress 'futile interpositions'
-	i = zoneTab[x] & Z_LAST; // Pawn not on first & last rank (OK for zh)
-	if(perpLoses) { // but it is Shogi!
-	    if(!(zoneTab[x] & stm)) i = 0; // outside zone, so dropping is always allowed
-	    else if(perpLoses < TORI_NR) { // Shogi variant with Lance
-		i *= 2;                    // no Pawn, then also no Lance!
-		last += 1 - (zoneTab[x] & (Z_2ND & ~COLOR)) + (perpLoses & 4) >> 3; // on last 2 ranks trim off Knight (not in Wa)
-	    }
-	    if(pawnCount[sqr2file[x]] & maxBulk[stm]) i += !i; // no Pawn in pawn-crowded file
-	}
-	for(; i<=last; i++) { // all droppable types
-	    int piece = s + i, from = handSlot[piece];
-	    if((signed char)board[from] < -1) // piece type is in hand
-		moveStack[moveSP++] = from << 8 | x;
-	}
-    }
-}
+typedef struct { // 24 bytes per node, written when its search returns (so children come before their parent)
+    Key key;
+    unsigned int nodes;       // nodeCount at that time, so differences give subtree sizes
+    short alpha, beta, score; // window the node was searched with, and what it returned
+    unsigned short move;      // move that led to it (0 = null move)
+    unsigned char ply;
+    signed char depth;
+    unsigned char stage;      // move-generation stage in the parent, 255 for a null-move search
+    unsigned char bound;      // H_LOWER and/or H_UPPER, as in the hash table
+} TraceRecord;
+
+TraceRecord *traceBuf;              // ring buffer holding the last traceSize nodes
+unsigned int traceSize, traceCount; // 0 = not tracing
+int tracePath[MAXPLY], tracePly;    // moves from the root to the traced subtree
+char traceFile[256];
 
 void
-AllDrops (int stm)
-{
-    int i, mask = lanceMask;
-    for(i=0; i<=maxDrop; i++) {
-	int piece = stm + i, from = handSlot[piece^COLOR];
-	if((signed char)board[from] < -1) { // piece type is in hand
-	    int r, f, start = 0, end = boardEnd;
-	    if(mask & 1) { // piece with drop limitation
-		int badZone = (i == 6 ? 44 : 22); // 6 is the Knight in (Judkins) Shogi
-		if(stm == BLACK || !perpLoses) start = badZone;
-		if(stm == WHITE || !perpLoses) end  -= badZone;
-	    }
-	    for(f=0; f<nrFiles; f++) {
-		if(i == 0 && pawnCount[f] & maxBulk[stm]) continue;
-		for(r=start; r<end; r+=22)
-		    if(board[r+f] == 0) moveStack[moveSP++] = from << 8 | f + r;
-	    }
-	}
-	mask >>= 1;
-    }
-}
-
-int
-DiscoTest (int stm, int fromSqr, int king, StackFrame *f)
-{
-    int vec = king - fromSqr;
-    int match = captCode[vec] & pinCodes;
-    if(match) { // from-square is aligned
-	int x = king, v = deltaVec[vec];
-	while(board[x-=v] == 0) {}   // scan ray
-	if(f->checker != x && !(board[x] & stm) && captCode[king-x] & pieceCode[board[x]]) { // discovered check
-	    if(f->checker != CK_NONE) f->checker = CK_DOUBLE;
-	    else f->checker = x, f->checkDir = v, f->checkDist = dist[x-king];
-	}
-    }
+TraceNode (Key key, int alpha, int beta, int lower, int upper, int depth, int stage)
+{ // record the node at the current ply, if it lies in the traced subtree
+  TraceRecord *r; int i, score = (lower >= beta ? lower : upper);
+  if(ply < tracePly) return;
+  for(i=0; i<tracePly; i++) if(path[i] != tracePath[i]) return;
+  r = traceBuf + traceCount++ % traceSize;
+  r->key = key; r->nodes = nodeCount;
+  r->alpha = alpha; r->beta = beta; r->score = score;
+  r->move = (ply ? path[ply-1] : 0); r->ply = ply; r->depth = depth; r->stage = stage;
+  r->bound = (lower > alpha)*H_LOWER + (upper < beta)*H_UPPER;
 }
 
-void
-CheckTest (int stm, StackFrame *ff, StackFrame *f)
-{
-    if(ff->mutation == -2) f->checker = CK_NONE, f->checkDist = 0; else { // null move never checks
-	int king = location[stm+31]; // own King
-	int vec = king - ff->toSqr;
-	int match = captCode[vec] & pieceCode[ff->toPiece];
-	f->checker = CK_NONE; f->checkDist = 0; // assume not in check
-	if(match & C_DISTANT) { // moving piece is aligned
-	    int x = ff->toSqr, v = deltaVec[vec];
-	    while(board[x+=v] == 0) {} // scan ray
-	    if(x == king) f->checker = ff->toSqr, f->checkDir = v, f->checkDist = dist[vec]; // ray is clear, distant check
-	} else if(match & C_CONTACT) f->checker = ff->toSqr, f->checkDir = 0; // contact check
-	if(ff->mutation != -1) { // board move (no drop)
-	    DiscoTest(stm, ff->fromSqr, king, f);
-	    if(board[ff->captSqr] == 0) DiscoTest(stm, ff->captSqr, king, f); // e.p. capture can discover check as well
-	}
-    }
-}
+#define TRACE(A, B, D, S) if(traceSize) TraceNode(f.newKey, A, B, -f.lim, -score, D, S) /* after searching daughter f */
+//ply==0 || path[0]==0x0017b1 && (ply==1 || (ply==2))
 
 int
-Pinned (int stm, int fromSqr, int xking)
+HisComp (const void *x, const void*y)
 {
-    int vec = xking - fromSqr;
-    int match = captCode[vec] & pinCodes;
-    if(match) {
-	int x = xking, v = deltaVec[vec];
-	while(board[x-=v] == 0) {}
-	if(!(board[x] & stm) && captCode[xking-x] & pieceCode[board[x]]) return 1; // guards & counters tests as own piece!
-    }
-    return 0;
-}
-
-int
-SafeIP (StackFrame *f)
-{   // figure out which squares are protected on the check ray
-    int result = 0, v = f->checkDir, x = f->checker, mask = 1;
-    while(board[x+=v] == 0) result |= (mask <<= 1)*(attackKey != attacks[x]);
-    return result & ~mask;
+    return history[*(int *)y & 0xFFFF] - history[*(int *)x & 0xFFFF];
 }
 
-int
-NonEvade (StackFrame *f)
-{
-    if((f->fromPiece & ~COLOR) != 31) { // moves non-royal (or drops)
-	int d;
-	if(f->checker == CK_DOUBLE) return 1; // never helps against double check
-	if(f->toSqr == f->checker) return 0;  // captures only checker: OK
-	d = dist[f->checker - f->toSqr];
-	if(d && deltaVec[f->toSqr - f->checker] == f->checkDir && d < f->checkDist) return 0; // interposes: OK
-	if(f->fromPiece + board[f->checker] == COLOR && f->toSqr - f->fromSqr & 1) return (board[f->toSqr] != 0);
-	return 1;
-    }
-    // king move
-    return 0; // for now, defer testing to daughter node
+static inline unsigned int
+HashCheck (HashEntry *e)
+{   // in a shared table the lock is XOR'ed with the data, so that entries torn by concurrent writers do not verify
+    unsigned int w[3];
+    memcpy(w, (char *) e + 4, 12);
+    return w[0] ^ w[1] ^ w[2];
 }
 
-int
-MakeMove (StackFrame *f, int move)
-{
-    int to, stm;
-    f->fromSqr = move >> 8 & 255;
-    to = move & 255;
-    f->wholeMove = move;
-    f->toSqr = f->captSqr = toDecode[to];                               // real to-square for to-encoded special moves
-    f->fromPiece = board[f->fromSqr];                                   // occupant or (for drops) complemented holdings count
-    if(f->checker != CK_NONE && NonEvade(f)) return 0;                  // abort if move did not evade existing check
-    f->mutation = (f->fromPiece >> 7) | f->fromPiece;                   // occupant or (for drops) -1
-    f->toPiece = f->mutation + dropType[f->fromSqr] | promoInc[to];     // (possibly promoted) occupant or (for drops) piece to drop
-    f->victim = board[f->captSqr];					// for now this is the replacement victim
-    f->newEval = f->pstEval; f->newKey  = f->hashKey;			// start building new key and eval
-    f->epSqr = 255;
-    f->rookSqr = sqr2file[f->toSqr] + (pawnCount - board);              // normally (i.e. when not castling) use for pawnCount
-    f->rook = board[f->rookSqr];					// save and update Pawn occupancy
-    board[f->rookSqr] = f->rook + pawnBulk[f->toPiece] - pawnBulk[f->mutation] - pawnBulk[f->victim]; // assumes all on same file!
-//printf("f=%02x t=%02x fp=%02x tp=%02x sp=%02x mut=%02x ep=%02x\n", f->fromSqr, f->toSqr, f->fromPiece, f->toPiece, f->savePiece, f->mutation, f->epSqr);
-    if(to >= specials) { // treat special moves for Chess
-	if(sqr2file[to] > 11) {                                         // e.p. capture, shift capture square
-//printf("# e.p. %02x\n", to);
-	    f->captSqr = toDecode[to-11];				// use to-codes from double pushes, which happen to be what we need
-	    f->victim  = board[f->captSqr];
-	    f->savePiece = board[f->toSqr];
-	    board[f->captSqr] = 0;					// e.p. is only case with toSqr != captSqr where we have to clear captSqr
-	} else if(sqr2file[to] < 8) {					// double push
-	    int xpawn = f->toPiece ^ COLOR;				// enemy Pawn
-	    if(board[f->toSqr + 1] == xpawn ||				// if land next to one
-	       board[f->toSqr - 1] == xpawn ) {
-		f->epSqr = (f->fromSqr + f->toSqr) >> 1;		// set e.p. rights
-	    }
-	} else { // castling. at this point we are set up to 'promote' a King to Rook (so the check tests sees the Rook, and UnMake restores location[K])
-	    f->rookSqr = zoneTab[to];					// Rook from-square
-	    f->rook = board[f->rookSqr];                                // arrange Rook to be put back on UnMake (pawnCount is never modified in chess)
-	    board[f->rookSqr] = 0;					// and remove it
-	    f->newEval -= PST[f->rook][f->rookSqr];
-	    f->newKey  -= KEY(f->rook, f->rookSqr);
-	    f->captSqr = dropType[to];					// this tabulates to-square of the King
-	    f->savePiece = f->victim;					// now toSqr and captSqr are different, make sure the piece that was on toSqr goes back there in UnMake
-	    f->victim = board[f->captSqr];				// should be 0, but who knows?
-	    f->toPiece = f->rook;					// make sure Rook (or whatever was in corner) will be placed on toSqr
-	    board[f->captSqr] = f->mutation;				// place the King
-	    f->newEval += PST[f->mutation][f->captSqr] + 50;		// add 50 cP castling bonus
-	    f->newKey  += KEY(f->mutation, f->captSqr);
-	    location[f->mutation] = f->captSqr;				// be sure King location stays known
-	}
+HashEntry *
+ProbeShared (HashEntry *entry, int lock, int *hit, HashEntry *copy)
+{   // bucket search in a table that other processes write concurrently: an entry is only verified (and used) as a
+    // private copy, as another process could overwrite it between the check and reading the data
+    int i;
+    for(i=0; i<4; i++, entry++) {
+	memcpy(copy, entry, sizeof(HashEntry));
+	__asm__ __volatile__("" ::: "memory"); // (so the compiler cannot read the shared entry again instead)
+	if((copy->lock ^ HashCheck(copy)) == lock) { *hit = 1; return entry; }
     }
-    board[f->fromSqr] = f->fromPiece - f->mutation;                     // 0 or (for drops) decremented count
-    board[f->toSqr]   = f->toPiece;
-    // Check if capturing own piece (same color)
-    if(f->victim && (f->victim & COLOR) == (f->toPiece & COLOR)) {
-	// Same-color capture: piece stays same color in hand
-	board[handSlotSame[f->victim]]--; // put victim in holdings (same color)
-	f->newEval += promoGain[f->toPiece] - promoGain[f->mutation]                                        + handValSame[f->victim] +
-		      PST[f->toPiece][f->toSqr] - PST[f->mutation][f->fromSqr] + PST[f->victim][f->captSqr];
-	f->newKey  += KEY(f->toPiece, f->toSqr) - KEY(f->mutation, f->fromSqr) - KEY(f->victim, f->captSqr) + handKeySame[f->victim];
-    } else {
-	// Normal capture: piece flips color
-	board[handSlot[f->victim]]--; // put victim in holdings (flipped color)
-	f->newEval += promoGain[f->toPiece] - promoGain[f->mutation]                                        + handVal[f->victim] +
-		      PST[f->toPiece][f->toSqr] - PST[f->mutation][f->fromSqr] + PST[f->victim][f->captSqr];
-	f->newKey  += KEY(f->toPiece, f->toSqr) - KEY(f->mutation, f->fromSqr) - KEY(f->victim, f->captSqr) + handKey[f->victim];
-    }
-//printf("# capt=%02x vic=%02x slot=%02x\n", f->captSqr, f->victim, handSlot[f->victim]);
-    stm = f->toPiece & COLOR;
-    f->bulk = promoGain[stm+30]; promoGain[stm+30] += handBulk[f->victim] - dropBulk[f->fromSqr];
-    location[f->toPiece] = f->toSqr;
-    checkHist[moveNr+ply+1] = f->checker;
-
-    return 1;
+    *hit = 0; return entry - 1;
 }
 
-void
-UnMake (StackFrame *f)
-{
-    board[f->rookSqr] = f->rook;      // restore either pawnCount or (after castling) Rook from-square
-    board[f->toSqr]   = f->savePiece; // put back the regularly captured piece (for castling that captured by Rook)
-    board[f->captSqr] = f->victim;    // differs from toSqr on e.p. (Pawn to-square) and castling, (King to-square) and should be cleared then
-    board[f->fromSqr] = f->fromPiece; //          and the mover
-    // Restore victim to hand (same location it was taken from)
-    if(f->victim && (f->victim & COLOR) == (f->toPiece & COLOR)) {
-	board[handSlotSame[f->victim]]++; // same-color capture
-    } else {
-	board[handSlot[f->victim]]++;     // normal capture (flipped color)
-    }
-    promoGain[(f->toPiece & COLOR)+30] = f->bulk;
-    location[f->fromPiece] = f->fromSqr;
+HashEntry *
+ProbeHash (Key key, int stm, int rights, int epSqr, int *hit, HashEntry *copy)
+{   // look for the position in its bucket of 4 entries; on a miss the last entry of the bucket is returned
+    // (the entry to store in), on a hit copy receives the data
+    int lock = key >> 32;
+    HashEntry *entry = hashTable + (key + (stm + 9849 + rights)*(epSqr + 51451) & hashMask);
+    if(sharedHash) return ProbeShared(entry, lock, hit, copy);
+    *hit = (entry->lock == lock || (++entry)->lock == lock || (++entry)->lock == lock || (++entry)->lock == lock);
+    if(*hit) *copy = *entry;
+    return entry;
 }
 
-#define PATH 0
-//ply==0 || path[0]==0x0017b1 && (ply==1 || (ply==2))
-
-int
-HisComp (const void *x, const void*y)
-{
-    return history[*(int *)y & 0xFFFF] - history[*(int *)x & 0xFFFF];
+static inline void
+StoreHash (HashEntry *entry, HashEntry *data, unsigned int lock)
+{   // write an entry that was built in private; in a shared table the check is taken from the data we write (not
+    // from the table, where another process could have replaced it), and the lock goes in after the data
+    if(sharedHash) lock ^= HashCheck(data);
+    memcpy((char *) entry + 4, (char *) data + 4, 12);
+    __asm__ __volatile__("" ::: "memory"); // (as in ProbeShared)
+    entry->lock = lock;
 }
- 
-int
-Search (int stm, int alpha, int beta, StackFrame *ff, int depth, int reduction, int maxDepth)
-{
-    MoveStack m; StackFrame f; HashEntry *entry;
-    int oldSP = moveSP, *pvStart = pvPtr, oldLimit = depthLimit, oldAna;
-    int killer1 = killers[ply][0], killer2 = killers[ply][1], hashMove;
-    int bestNr, bestScore, startAlpha, startScore, resultDepth, iterDepth=0, originalReduction = reduction;
-    int hit, hashKeyH, ran=0, ipMask=0;
-    int curEval, anaEval, score, upperScore, minScore = -INF, maxScore = INF;
-
-    // legality
-    int earlyGen = (ff->fromPiece == stm+31); // King was moved
-    if(ply > 90) { if(DEBUG) Dump("maxply"); ff->depth = 0; ff->lim = ff->newEval-150; return -ff->newEval+150; }
-    f.xking = location[stm+31]; // opponent King, as stm not yet toggled
-    if(!earlyGen && ff->mutation > 0) { // if other piece was moved (not dropped!), abort with +INF score if it was pinned
-	if(Pinned(stm, ff->fromSqr, f.xking) ||
-	   board[ff->captSqr] == 0 && Pinned(stm, ff->captSqr, f.xking)) { // also check 'e.p. pin'
-	    ff->depth = MAXPLY; ff->lim = -INF; return INF;
-	}
-    }
-
-
-    // some housekeeping
-    stm ^= COLOR;
-    f.hashKey =  ff->newKey;
-    f.pstEval = -ff->newEval;
-    f.rights  =  ff->rights | spoiler[ff->toSqr] | spoiler[ff->fromSqr];
-    m.epSqr   =  ff->epSqr; // put in m, because MoveGen needs it
-
-    // hash probe
-    hashKeyH = f.hashKey >> 32;
-    entry = hashTable + (f.hashKey + (stm + 9849 + f.rights)*(m.epSqr + 51451) & hashMask);
-    if(entry->lock == hashKeyH || (++entry)->lock == hashKeyH || (++entry)->lock == hashKeyH || (++entry)->lock == hashKeyH) { // 4 possible entries
-	int score = entry->score, d = entry->depth;
-	signed char p;
-
-	f.checker = entry->checker; f.checkDist = 0;
-	if(f.checker != CK_NONE) { // in check; restore info needed in evasion test
-	    if(sqr2file[f.checker] != 12) f.checkDir = 0; else { // off-board represents on-board distant check
-		int vec = location[stm+31] - (f.checker -= 11);
-		f.checkDir = deltaVec[vec];
-		f.checkDist = dist[vec];
-	    }
-	    reduction = 0; // checks are not reduced
-	}
-	if(score >= beta || entry->lim <= alpha || entry->score == entry->lim) { // only take hash cuts from fully resolved results, unless they fail low or high
-	    d += (score >= beta & entry->depth >= LMR)*reduction; // fail highs need to satisfy reduced depth only, so we fake higher depth than actually found
-	    if((score > alpha && d >= depth || d >= maxDepth) && ply) { // sufficient depth
-		ff->depth = d + 1; ff->lim = -entry->score; return entry->lim; // depth was sufficient, take hash cutoff
-	    }
-	}
-	hashMove = entry->move;
-	hit = 1;
-	p = board[hashMove>>8&255];
-	if(hashMove && ((p & stm) == 0 || p == -1)) {
-	    if(DEBUG) printf("telluser bad hash move %16llx: %s\n", f.hashKey, MoveToText(hashMove));
-	    hashMove = 0; f.checker = CK_UNKNOWN;
-	}
-    } else hit = hashMove = 0, f.checker = CK_UNKNOWN;
-
-    moveSP += 48;  // create space for non-captures
-    if(earlyGen) { // last moved piece was King, e.p. capture or castling
-	int kingCapt;
-	if(!ff->victim) board[ff->toSqr] = stm + 31 ^ COLOR; // kludge: after castling we temporarily make Rook a second King to catch passing through check
-	kingCapt = MoveGen(stm, &m, f.rights);
-	board[ff->toSqr] = ff->toPiece; // undo kludge damage
-	if(kingCapt) { moveSP = oldSP; ff->depth = MAXPLY; ff->lim = -INF; return INF; } // make sure we detect if he moved into check
-    }
-
-    if((++nodeCount & 0xFFF) == 0) abortFlag |= TimeIsUp(3); // check time limit every 4K nodes
-    curEval = f.pstEval + Evaluate(stm, f.rights);
-    alpha -= (alpha < curEval); //pre-compensate delayed-loss bonus
-    beta  -= (beta <= curEval);
-    if(ff->checker == CK_NONE) killers[ply+1][0] = killers[ply+1][1] /* = killers[ply+1][2]*/ = 0;
-    else if(ply > 0) killers[ply+1][0] = killers[ply-1][0], killers[ply+1][1] = killers[ply-1][1]; // inherit killers after check+evasion
-    if(-INF >= beta) { moveSP = oldSP; ff->depth = MAXPLY; ff->lim = INF-1; return INF; }
-
-
-    // check test
-    if(f.checker == CK_UNKNOWN) CheckTest(stm, ff, &f); // test for check if hash did not supply it
-    if(f.checker != CK_NONE) {
-	depth++, maxDepth++, reduction = originalReduction = 0 /*, killers[ply][2] = -1*/; // extend check evasions
-	if(earlyGen && f.checkDist && maxDepth <= 1) ipMask = SafeIP(&f);
-    } else if(depth > LMR) {
-	if(depth - reduction < LMR) reduction = depth - LMR; // never reduce to below 'LMR' ply
-	depth -= reduction;
-    } else reduction = originalReduction = 0;
-    checkHist[moveNr+ply+1] = f.checker;
-    oldAna = anaSP; anaSP += (ff->checker != CK_NONE); // node after evasion: accept new analogy
-    anaEval = curEval;
-
-    // stand pat or null move
-    startAlpha = alpha; startScore = -INF;
-    if(depth <= 0) { // QS
-	if(ff->checker != CK_NONE && ff->tpGain > 0) anaEval = 50-INF; // forbid stand pat if horizon check tossed material
-	if(anaEval > alpha) {
-	    if(anaEval >= beta) { ff->depth = 1; ff->lim = -anaEval - (anaEval < curEval); moveSP = oldSP; anaSP = oldAna; return INF; } // stand-pat cutoff
-	    alpha = startScore = anaEval; maxDepth = 0; // we will not fail low, so no extra iterations
-	}
-	if(maxDepth <= 0) {
-	    if(board[toDecode[hashMove&255]] == 0) hashMove = 0;
-#ifdef IDQS
-	    if(ply >= depthLimit) { ff->depth = 1; ff->lim = -anaEval-150; moveSP = oldSP; anaSP = oldAna; return anaEval + 150; } // hit depth limit; give hefty stm bonus
-	    if(depthLimit == MAXPLY) depthLimit = ply+10; // we just entered pure QS; set up depth limit
-#endif
- 	}
-    } else if(curEval >= beta && f.checker == CK_NONE) {
-	int nullDepth = depth - 3;
-	int eva = (ff->checker != CK_NONE) && !oldAna && nullDepth >= 0; // first evasion in branch, and depth of null-move search was higher before the check
-	nullDepth += eva; // reduce one less than normal after first evasion, to make sure we see same threats after spite check
-	if(nullDepth < 0) nullDepth = 0;
-	f.mutation = -2; // kludge to suppress testing for discovered check
-	f.newEval = f.pstEval;
-	f.newKey = f.hashKey;
-	f.epSqr = -1; f.fromSqr = f.toSqr = f.captSqr = 1; f.toPiece = board[1];
-	deprec[ply] = maxDepth << 16 | depth << 8; path[ply++] = 0;
-	score = -Search(stm, -beta, 1-beta, &f, nullDepth, 0, nullDepth);
-	ply--;
-	if(score >= beta) { ff->depth = f.depth + originalReduction + 3; ff->lim = -beta-1; moveSP = oldSP; anaSP = oldAna; return INF; }
-    }
-
-    // move generation
-    if(!earlyGen) { // generate moves if we had not done so yet
-	if(MoveGen(stm, &m, f.rights)) { // impossible (except for hash collision giving wrong in-check status)
-	    if(DEBUG) Dump("King capture"); ff->depth = MAXPLY; ff->lim = -INF; moveSP = oldSP; anaSP = oldAna; return INF;
-	}
- 	if(f.checkDist && maxDepth <= 1) ipMask = SafeIP(&f);
-    }
-    if(hashMove) moveStack[--m.firstMove] = hashMove; // put hash move in front of list (duplicat!)
-    if(f.checker != CK_NONE) moveSP = m.drops = m.castlings; // clip off castlings when in check
-    if(ff->checker != CK_NONE) { // last move was evasion; see if we have counter move
-	int move = mateKillers[(ff->wholeMove & 0xFFFF) + (stm - WHITE << 11)];
-	if(move && (move>>16 & 0xFF) == f.xking && (move>>24 & 0xFF) == board[toDecode[move & 0xFF]] && PseudoLegal(stm, move)) { // counter move is pseudo-legal and matches position
-	    moveStack[moveSP++] = moveStack[m.nonCapts]; moveStack[m.nonCapts] = move & 0xFFFF; m.late = ++m.nonCapts; // make room and put with captures (lowest sort key)
-	}
-    }
-
-    if(depth <= 0 && anaEval == curEval) {
-	int bonus = (m.safety + 3*m.hole)*(10 + m.safety + m.hole + promoGain[stm+30] /*- 0*promoGain[COLOR-stm+30]*/) + 15*m.cBonus;
-	bonus += (m.escape < 2 ? 200 - m.escape*100 : 0);
-	if(bonus > 900) bonus = 900; // S4
-	bonus += bonus >> 1;
-	int newEval = curEval + bonus;
-	if(newEval > alpha) {
-	    if(newEval >= beta) { ff->depth = 1; ff->lim = -newEval; moveSP = oldSP; depthLimit = oldLimit; anaSP = oldAna; return INF; } // stand-pat cutoff
-	    alpha = startScore = newEval; maxDepth = 0; // we will not fail low, so no extra iterations
-	}
-   }
-
-  again: // QS IDD loop
-    do { // IID loop
-	int curMove, highDepth;
-	iterDepth++;
-	highDepth = (iterDepth > depth ? iterDepth : depth) - 1; // reply depth for high-failing moves
-	pvPtr = pvStart; *pvPtr++ = 0; // empty PV
-	bestScore = upperScore = startScore; bestNr = 0; // kludge: points to 0 entry in moveStack
-	resultDepth = MAXPLY;
-	m.stage &= 3;
-	for(curMove=m.firstMove; m.stage<4; curMove++) {
-	    int score;
-
-	    // sort section
-	    if(curMove >= m.unsorted) {
-		if(curMove < m.nonCapts) { // captures: extract best
-		    unsigned int i, bestNr = curMove, bestCapt = moveStack[curMove];
-		    for(i=curMove+1; i<m.nonCapts; i++) if(moveStack[i] > bestCapt) bestCapt = moveStack[bestNr=i]; // find best
-		    moveStack[bestNr] = moveStack[curMove]; moveStack[curMove] = bestCapt; // swap it to front
-		    m.unsorted = curMove + 1; // sorted set now includes move
-		} else {
-		    if(maxDepth <= 0) { 
-			resultDepth = 0; if(upperScore < anaEval) upperScore = anaEval;
-			if(m.stage) break;
-			moveSP = curMove;
-			if(ff->checker != CK_NONE && depthLimit != MAXPLY && oldLimit == MAXPLY) { // last move before QS was evasion
-			    CheckDrops(stm, f.xking); // also do check drops
-			    if(moveSP > curMove) { m.stage = 3; m.unsorted = moveSP; curMove--; continue; }
-			}
-			if(depthLimit == MAXPLY || oldLimit != MAXPLY || checkHist[moveNr+ply-1] == CK_NONE) break;
-			if(killer1 && PseudoLegal(stm, killer1)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer1; // try (possibly inherited) killers
-			if(killer2 && PseudoLegal(stm, killer2)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer2;
-			CheckDrops(stm, f.xking);
-			if(curMove >= moveSP) break;
-			m.stage = 3; m.unsorted = moveSP;
-			curMove--;
-			continue;
-		    } // in QS we stop after captures
-		    switch(m.stage) { // we reached non-captures
-		      case 0:
-			if(f.checker == CK_NONE) { // do not use killers when in check
-			    if(killer1 && PseudoLegal(stm, killer1)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer1; // insert killers
-			    if(killer2 && PseudoLegal(stm, killer2)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer2; // (original goes to end)
-			}
-			m.drops = moveSP;
-			// here we can sort based on history
-			if(moveSP > m.late) qsort(moveStack + m.late, moveSP - m.late, sizeof(int), &HisComp);
-			m.stage = 1; if(moveSP > curMove) break;
-		      case 1:
-			if(f.checker != CK_NONE) {
-			    m.stage |= 4; // when in check we stop after evasion drops
-			    if(f.checkDist == 0) continue; // but there cannot be any for contact/double checks
-			    EvasionDrops(stm, &f, ipMask); // at d <= 1 suppress futile interpositions
-			    if(moveSP <= curMove) continue; // no avail
-			    m.stage = 3; break;
-			}
-			CheckDrops(stm, f.xking);
-			m.stage = 2; if(moveSP > curMove) break;
-		      case 2:
-			if(iterDepth > 1) { // quiet drops only at depth >= 2
-			    AllDrops(stm);
-			    m.stage = 3; if(moveSP > curMove) break;
-			}
-		      case 3:
-			m.stage |= 4; continue; // this value of m.stage terminates the loop over moves
-		    }
-		    m.unsorted = moveSP; // set to return here when done with the current list
-		}
-	    }
-
-	    // make move
-	    if(MakeMove(&f, moveStack[curMove])) { // aborts if fails to evade existing check
-
-		// repetition checking
-		int index = (unsigned int)f.newKey >> 24 ^ stm << 2; // uses high byte of low (= hands-free) key
-		while(repKey[index] && (repKey[index] ^ (int)f.newKey) & 0xFFFFF) index++;
-		int oldRepKey = repKey[index], oldRepDep = repDep[index];
-		if(oldRepKey && ff->mutation != -2) { // key present in table: (quasi-)repetition
-		    int gain = (f.newEval << 20) - (repKey[index] & 0xFFF00000);
-		    if(gain == 0) { // true repeat
-			score = 0;
-			if(perpLoses) { // repetitions not always draw
-			    int i, d = repDep[index];
-			    for(i=moveNr+ply-1; i>=d; i-=2) if(checkHist[i+1] == CK_NONE) break;
-			    if(i < d) score = -INF; // we deliver a perpetual, so lose
-			    else {
-				for(i=moveNr+ply-2; i>=d; i-=2) if(checkHist[i+1] == CK_NONE) break;
-				if(i < d) score = INF-1; // we are suffering a perpetual, so lose
-				else if(perpLoses == 1) score = (stm == WHITE ? -INF : INF-1); // mini-Shogi, sente loses
-				else if(perpLoses == TORI_NR) score = -INF; // Tori Shogi, repeating loses
-			    }
-			   
-			}
-		    }
-		    else if(gain == pawn  || gain == queen  || gain >= (400<<20)) score = INF-1;  // quasi-repeat with extra piece in hand
-		    else if(gain == -pawn || gain == -queen || gain <= (-400<<20)) score = 1-INF; // or with one piece less
-		    else goto search;// traded one hand piece for another; could still lead somewhere
-		    f.lim = score; f.depth = (score >= beta ? highDepth+1 : iterDepth); // minimum required depth
-		    *pvPtr = 0; // fake that daughter returned empty PV
-		} else { // not a repeat: search it
-		    int lmr;
-		  search:
-		    lmr = (curMove >= m.late) + (curMove >= m.drops);
-		    f.tpGain = f.newEval + ff->pstEval;     // material gain in last two ply
-		    if(ply==0 && randomize && moveNr < 10) ran = (alpha > INF-100 || alpha <-INF+100 ? 0 : (f.newKey*ranKey>>24 & 31)- 16);
-		    repKey[index] = (int)f.newKey & 0xFFFFF | f.newEval << 20; repDep[index] = ply + moveNr; // remember position
-		    // recursion
-		    deprec[ply] = (f.checker != CK_NONE ? f.checker : 0)<<24 | maxDepth<<16 | depth<< 8 | iterDepth; path[ply++] = moveStack[curMove] & 0xFFFF;
-		    score = -Search(stm, -beta, -alpha+ran, &f, iterDepth-1, lmr, highDepth);
-		    if(ran && score < INF-100 && score > 100-INF) score += ran, f.lim += ran;
-		    ply--;
-
-		    repKey[index] = oldRepKey; repDep[index] = oldRepDep;
-		}
-
-		// unmake
-		UnMake(&f);
-
-	    } else score = f.lim = -INF, f.depth = MAXPLY;
-if(PATH){
-int m=moveStack[curMove];
-printf("%d:%d:%d %2d. %08x %c%d%c%d %6d %6d %6d\n",ply,depth,iterDepth,curMove,m,(m>>8&255)%22+'a',(m>>8&255)/22+1,toDecode[m&255]%22+'a',toDecode[m&255]/22+1,f.pstEval,score,bestScore);
-}
-
-	    if(abortFlag) { moveSP = oldSP; depthLimit = oldLimit; anaSP = oldAna; return -INF; }
-
-	    // minimaxing
-	    if(f.depth < resultDepth) resultDepth = f.depth;
-	    if(f.lim > upperScore) upperScore = f.lim;
-
-	    if(score > bestScore) {
-		bestScore = score;
-		if(score > alpha) {
-		    int *tail;
-		    alpha = score; bestNr = curMove;
-		    history[moveStack[curMove] & 0xFFFF] += iterDepth*iterDepth;
-		    if(score > INF-100 && curMove >= m.nonCapts)
-			mateKillers[(ff->wholeMove & 0xFFFF) + (stm - WHITE << 11)] = moveStack[curMove] & 0xFFFF | f.xking << 16 | board[f.toSqr] << 24; // store mate killers
-		    if(score >= beta) { // beta cutoff
-			if(f.checker == CK_NONE && curMove >= m.nonCapts && moveStack[curMove] != killers[ply][1])
-			    killers[ply][0] = killers[ply][1], killers[ply][1] = moveStack[curMove];
-			resultDepth = f.depth;
-			upperScore = INF; goto cutoff; // done with this node
-		    }
-		    tail = pvPtr; pvPtr = pvStart; *pvPtr++ = moveStack[curMove]; // alpha < score < beta: move starts new PV
-		    while(*pvPtr++ = *tail++); // copy PV of daughter node behind it (including 0 sentinel)
-		    if(ply == 0) { // in root we print this PV
-			int xbScore = (score > INF-100 ? 100000 + INF - score : score < 100-INF ? -100000 - score - INF : score);
-			printf("%d %d %d %d", iterDepth, xbScore, ReadClock(0)/10, nodeCount);
-			for(tail=pvStart; *tail; tail++) printf(" %s", MoveToText(*tail));
-			printf("\n"); fflush(stdout);
-			ff->move = moveStack[bestNr];
-		    }
-		}
-	    }
-	}   // move loop
 
-	// stalemate correction
+#include "search.c" // generic instance
+
+// crazyhouse instance: board dimensions, hand size and rule flags become compile-time constants
+#define nrFiles          8
+#define nrRanks          8
+#define boardEnd         (22*8)
+#define specials         (22*8)
+#define maxDrop          4
+#define lanceMask        1
+#define perpLoses        0
+#define frontier         (2*22)
+#define killZone         (3*22)
+#define impasse          (22*8)
+#define frontierPenalty  2
+#define killPenalty      8
+#define Evaluate         EvaluateZH
+#define SquareAttacked   SquareAttackedZH
+#define Legal            LegalZH
+#define PseudoLegal      PseudoLegalZH
+#define MoveGen          MoveGenZH
+#define CheckDrops       CheckDropsZH
+#define EvasionDrops     EvasionDropsZH
+#define AllDrops         AllDropsZH
+#define DiscoTest        DiscoTestZH
+#define CheckTest        CheckTestZH
+#define RootCheck        RootCheckZH
+#define SafeIP           SafeIPZH
+#define NonEvade         NonEvadeZH
+#define MakeMove         MakeMoveZH
+#define UnMake           UnMakeZH
+#define Search           SearchZH
+#define Perft            PerftZH
+#include "search.c"
+#undef nrFiles
+#undef nrRanks
+#undef boardEnd
+#undef specials
+#undef maxDrop
+#undef lanceMask
+#undef perpLoses
+#undef frontier
+#undef killZone
+#undef impasse
+#undef frontierPenalty
+#undef killPenalty
+#undef Evaluate
+#undef SquareAttacked
+#undef Legal
+#undef PseudoLegal
+#undef MoveGen
+#undef CheckDrops
+#undef EvasionDrops
+#undef AllDrops
+#undef DiscoTest
+#undef CheckTest
+#undef RootCheck
+#undef SafeIP
+#undef NonEvade
+#undef MakeMove
+#undef UnMake
+#undef Search
+#undef Perft
 
-	// self-deepening
-	if(resultDepth > iterDepth) iterDepth = resultDepth; // unexpectedly deep result (from hashed daughters?)
-	if(reduction && iterDepth == depth) depth += reduction, originalReduction = reduction = 0; // no fail high, start unreduced re-search on behalf of parent
-	if(iterDepth >= depth && alpha > startAlpha ) break; // move is PV; nominal depth suffices
-	alpha = startAlpha; // reset alpha for next iteration
-
-	// put best in front
-	if(bestNr > m.firstMove) {
-	    int bestMove = moveStack[bestNr];
-	    if(bestNr == m.firstMove+1) moveStack[bestNr] = moveStack[m.firstMove]; else m.firstMove--; // swap first two, or prepend duplicat
-	    moveStack[bestNr = m.firstMove] = bestMove;
-	} else m.late += (m.late == bestNr); // if best already in front (or non-existing), just make sure it is not reduced
-
-    } while(iterDepth < maxDepth && (ply || !TimeIsUp(1)));   // IID loop
-
-    if(upperScore == -INF) { // we are mated!
-	if(perpLoses) {     // Shogi
-	    if(ff->fromSqr == handSlot[stm]) bestScore = upperScore = INF; // mated by Pawn drop, so we win!
-	} else if(f.checker == CK_NONE) bestScore = upperScore = 0;        // stalemate in zh is draw
-    }
-
-  cutoff:
-
-#ifdef IDQS
-    if(depthLimit != MAXPLY) { // we are in iteratively deepening QS
-	if(bestScore < minScore) { bestScore = minScore; if(upperScore < bestScore) upperScore = bestScore; } // when we aspired with the previous result, fail high and low must mean score is on edge
-	if(upperScore > maxScore) { upperScore = maxScore; if(upperScore < bestScore) bestScore = upperScore; }
-	if(oldLimit == MAXPLY && bestScore != upperScore && bestScore < beta && upperScore > alpha) { // we are in the root of QS and the score is unresolved
-	    depthLimit+=10; alpha = startScore = curEval; iterDepth = 0; // increase depth limit and search again
-	    goto again;
-	}
-    }
-#endif
-
-    // delayed-loss bonus
-    bestScore += (bestScore < curEval);
-    upperScore += (upperScore < curEval);
-    resultDepth -= (f.checker != CK_NONE); // store unextended depth
-
-    // hash store
-    if(!hit) { // replacement
-//	if(searchNr - entry[-3].age > 2) entry -= 3; else { // replace primary hit if stale
-	{
-	    HashEntry *entry2 = entry - 3;
-	    entry2 += (entry2[0].depth > entry2[1].depth);
-	    entry -= (entry[0].depth > entry[-1].depth);
-	    if(entry->depth > entry2->depth) entry = entry2;
-	}
-    }
-    entry->lock = hashKeyH;
-    entry->move = moveStack[bestNr]; // if no move was found, bestNr = 0, and moveStack[0] contains INVALID
-    entry->score = bestScore;
-    entry->lim = upperScore;
-    entry->depth = resultDepth;
-    entry->flags = (bestScore > alpha)*H_LOWER + (bestScore < beta)*H_UPPER;
-    entry->checker = f.checker + 11*(f.checkDist != 0); // encode distant check as off-board checker
-
-    // return results
-    moveSP = oldSP; anaSP = oldAna; pvPtr = pvStart; depthLimit = oldLimit;
-    ff->depth = resultDepth + 1 + originalReduction; // report valid depth as seen from parent
-    ff->lim = -bestScore;
-    return upperScore;
-}
 
 int gameMove[MAXMOVES];  // holds the game history
 int stm = WHITE;
@@ -1528,10 +1039,20 @@ int stm = WHITE;
 // Some routines your engine should have to do the various essential things
 void PonderUntilInput(int stm);         // Search current position for stm, deepening forever until there is input.
 
+volatile int stopSearch; // set by DropperStop
+volatile int *reviewStop; // during a game review: flag shared by all its processes
+int reviewInput;          // new input also stops the review (xboard)
+
 int
 TimeIsUp (int mode)
 { // determine if we should stop, depending on time already used, TC mode, time left on clock and from where it is called ('mode')
   int t = ReadClock(0), targetTime, panicTime;
+  if(reviewStop) {                                     // a game review stops in all processes at once
+    if(stopSearch || (reviewInput && InputPending())) *reviewStop = 1;
+    if(*reviewStop) return 1;
+  }
+  if(stopSearch) return 1;                             // asked to stop through the library interface
+  if(workerMode && InputPending()) return 1;           // or by the coordinator of a distributed search
   if(timePerMove >= 0) {                               // fixed time per move
     targetTime = panicTime = 10*timeLeft - 30;
   } else if(mps) {                                     // classical TC
@@ -1553,14 +1074,57 @@ TimeIsUp (int mode)
 }
 
 StackFrame undoInfo;
+char startFEN[512];
+unsigned char rootRecord[11*11+2*16+2]; // packed start position, when the game was set up from one
+int rootPacked;                         // startFEN still has to be written from rootRecord
+
+typedef struct { // what is needed to take back a game move without replaying the game
+  StackFrame state; // undoInfo after the move (for UnMake), or after Setup for ply 0
+  int repIndex, repKey; // slot in the game-history hash the position went into, and what that held before
+  unsigned char repDep;
+} GamePly;
+
+GamePly gameHistory[MAXMOVES+1]; // indexed by moveNr
+int gameLength;                  // moves in gameMove[] that can be redone
+
+int
+PlacePiece (int piece, int sqr)
+{ // put a piece on an empty board square; returns its PST eval (white POV)
+  board[sqr] = piece; location[piece] = sqr;      // place piece
+  ADD_PIECE(SIDE(piece), sqr);                    // and add it to the piece list
+  hashKey += KEY(piece, sqr);                     // update hash key
+  pawnCount[sqr2file[sqr]] += pawnBulk[piece];    // Pawn occupancy per file
+  return (piece & WHITE ? 1 : -1)*(PST[piece][sqr]+pieceValues[piece]);
+}
+
+int
+AddToHand (int piece)
+{ // put a piece in the hand of its color; returns its eval (white POV)
+  board[handSlot[piece ^ COLOR]]--;               // count piece in hand
+  handBits |= HAND_BIT(piece);                    // and mark the type as present
+  hashKey += handKey[piece ^ COLOR];              // update hash key
+  promoGain[(piece & COLOR)+30] += handBulk[piece];
+  return (piece & WHITE ? 1 : -1)*(handVal[piece] - pieceValues[piece]);
+}
+
+void
+SetRoot (int stm, int rights, int epSqr, int pstEval)
+{ // make a newly set up position the game position
+  undoInfo.rights = rights; undoInfo.fromSqr = undoInfo.toSqr = undoInfo.captSqr = 44; undoInfo.toPiece = board[44]; // kludge to prevent spoiling of rights
+  undoInfo.epSqr = epSqr;
+  undoInfo.newEval = (stm == WHITE ? pstEval : -pstEval);
+  undoInfo.newKey = hashKey;
+  gameHistory[0].state = undoInfo; gameLength = 0;
+  lastGameMove = 0;  // TODO: use FEN e.p. rights to fake double-push here
+}
 
 int
 Setup (char *fen)
 { // very flaky FEN parser
-  static char castle[] = "KkQq-", startFEN[200];
+  static char castle[] = "KkQq-";
   int pstEval, rights, stm = WHITE, i, p, sqr = 22*(nrRanks-1); // upper-left corner
   ClearBoard();
-  if(!fen) fen = startFEN; else strcpy(startFEN, fen); // remember start position, or use remembered one if not given
+  if(!fen) fen = startFEN; else strcpy(startFEN, fen), rootPacked = 0; // remember start position, or use remembered one if not given
   if(strchr(fen, '*') && strlen(fen) > 30) fen += 18;  // Alien-Edition Wa implementation; strip off leading 11/11/***********/
   rights = 15; pstEval = 0;               // no castling rights, balance score
   hashKey = pawnKey = 0;                  // clear hash keys
@@ -1579,10 +1143,7 @@ Setup (char *fen)
       if(p == 'K') i = 31;                            // K is not in list, and (royal) piece 31 in any variant
       if(p == 'Q' && *fen == '~') i = 0;              // Q~ is +P, not +Q
       i |= color + 16*prom;                           // adjust type for color and promotion
-      board[sqr] = i; location[i] = sqr;              // place piece
-      hashKey += KEY(i, sqr);                         // update hash key
-      pstEval += (color & WHITE ? 1 : -1)*(PST[i][sqr]+pieceValues[i]);// update PST eval (white POV)
-      pawnCount[sqr2file[sqr]] += pawnBulk[i];        // Pawn occupancy per file
+      pstEval += PlacePiece(i, sqr);
       sqr++;
     }
     fen++;
@@ -1595,11 +1156,7 @@ Setup (char *fen)
       p &= ~32; color = *fen++ - p + WHITE;
       i = 0; while(pieces[i] && pieces[i] != p) i++;  // identify piece type
       i |= color;                                     // adjust type for color
-      sqr = handSlot[i ^ COLOR];                      // determine counter location
-      board[sqr]--;                                   // count piece in hand      
-      hashKey += handKey[i ^ COLOR];                  // update hash key
-      pstEval += (color & WHITE ? 1 : -1)*(handVal[i] - pieceValues[i]); // update PST eval (white POV)
-      promoGain[color+30] += handBulk[i];
+      pstEval += AddToHand(i);
     }
     fen++;    // skip closing bracket
   }
@@ -1612,14 +1169,88 @@ Setup (char *fen)
     fen++;
   }
 
-  undoInfo.rights = rights; undoInfo.fromSqr = undoInfo.toSqr = undoInfo.captSqr = 44; undoInfo.toPiece = board[44]; // kludge to prevent spoiling of rights
-  undoInfo.newEval = (stm == WHITE ? pstEval : -pstEval);
-  undoInfo.newKey = hashKey;
+  SetRoot(stm, rights, 255, pstEval);
+  return stm;
+}
 
-  lastGameMove = 0;  // TODO: use FEN e.p. rights to fake double-push here
+// Packed positions, for tools that handle them in bulk: a record of fixed size (per variant) holding a byte
+// for every board square (0 or the piece), the hand counts of white and then black (a byte per droppable type,
+// wherever the pieces came from), the side to move (bit 7) with the lost castling rights, and the e.p. square.
+
+int
+PackSize ()
+{
+  return nrFiles*nrRanks + 2*(maxDrop+1) + 2;
+}
+
+int
+PackPosition (unsigned char *rec)
+{ // store the game position; returns the size of the record
+  int r, f, i;
+  for(r=0; r<nrRanks; r++) for(f=0; f<nrFiles; f++) *rec++ = board[22*r+f];
+  for(i=0; i<=maxDrop; i++) *rec++ = 255 - board[handSlot[WHITE+i ^ COLOR]];
+  for(i=0; i<=maxDrop; i++) *rec++ = 255 - board[handSlot[BLACK+i ^ COLOR]];
+  *rec++ = (stm == BLACK) << 7 | undoInfo.rights | spoiler[undoInfo.fromSqr] | spoiler[undoInfo.toSqr];
+  *rec = undoInfo.epSqr;
+  return PackSize();
+}
+
+int
+UnpackPosition (unsigned char *rec)
+{ // set up a packed position as Setup would the equivalent FEN (except for remembering it); returns the
+  // side to move, or 0 if the record is not a position of this variant that the search could handle
+  int i, n, sqr, pstEval = 0, squares = nrFiles*nrRanks, stm = (rec[squares + 2*(maxDrop+1)] & 128 ? BLACK : WHITE);
+  int ep = rec[squares + 2*(maxDrop+1) + 1], back = (stm == WHITE ? 22 : -22), kings = 0;
+  for(i=0; i<squares; i++) if(rec[i] && (rec[i] < WHITE || rec[i] >= COLOR || !firstDir[rec[i]-WHITE])) return 0;
+  for(i=0; i<squares; i++) kings += (rec[i] == WHITE+31) + 256*(rec[i] == BLACK+31);
+  if(kings != 257) return 0;            // not exactly one King per side
+  for(i=n=0; i<2*(maxDrop+1); i++) n += rec[squares+i];
+  if(n > squares) return 0;             // more than could ever be captured would wrap the hand counters
+#define REC(S) rec[(S)/22*nrFiles + (S)%22]
+  if(ep != 255 && (ep%22 >= nrFiles || ep/22 < 1 || ep/22 >= nrRanks-1 || !(zoneTab[ep+back] & Z_DOUBLE)
+                   || REC(ep-back) != (stm ^ COLOR) || REC(ep) || REC(ep+back))) return 0; // not skipped by an enemy Pawn
+#undef REC
+  ClearBoard();
+  hashKey = pawnKey = 0;
+  for(i=0; i<squares; i++, rec++) if(*rec) sqr = 22*(i/nrFiles) + i%nrFiles, pstEval += PlacePiece(*rec, sqr);
+  for(i=0; i<=maxDrop; i++, rec++) for(n=*rec; n>0; n--) pstEval += AddToHand(WHITE+i);
+  for(i=0; i<=maxDrop; i++, rec++) for(n=*rec; n>0; n--) pstEval += AddToHand(BLACK+i);
+  SetRoot(stm, *rec & 15, rec[1], stm == BLACK ? -pstEval : pstEval);
   return stm;
 }
 
+int
+UnpackRoot (unsigned char *rec)
+{ // start a game from a packed position, keeping the record to tell workers what the game started from
+  int s = UnpackPosition(rec);
+  if(s) stm = s, moveNr = 0, memcpy(rootRecord, rec, PackSize()), rootPacked = 1;
+  return s;
+}
+
+void
+RecordToFEN (unsigned char *rec, char *fen)
+{ // write a packed position as a FEN that Setup reads back (it ignores e.p. rights, so these are left out)
+  static char castle[] = "KQkq", bit[] = { 1, 4, 2, 8 }; // (Setup's rights bits are in KkQq order)
+  int r, f, i, n, p, squares = nrFiles*nrRanks, flags = rec[squares + 2*(maxDrop+1)];
+  for(r=nrRanks-1; r>=0; r--) {
+    for(f=n=0; f<nrFiles; f++) {
+      if(!(p = rec[nrFiles*r + f])) { n++; continue; }
+      if(n) fen += sprintf(fen, "%d", n), n = 0;
+      if((p & 31) != 31 && p & 16) *fen++ = '+';      // promoted
+      *fen++ = ((p & 31) == 31 ? 'K' : pieces[p & 15]) | (p & BLACK ? 32 : 0);
+    }
+    if(n) fen += sprintf(fen, "%d", n);
+    *fen++ = (r ? '/' : '[');
+  }
+  for(i=0; i<=maxDrop; i++) for(n=rec[squares+i]; n>0; n--) *fen++ = pieces[i];
+  for(i=0; i<=maxDrop; i++) for(n=rec[squares+maxDrop+1+i]; n>0; n--) *fen++ = pieces[i] | 32;
+  if(fen[-1] == '[') *fen++ = '-';
+  fen += sprintf(fen, "] %c ", flags & 128 ? 'b' : 'w');
+  for(i=0; i<4; i++) if(!(flags & bit[i])) *fen++ = castle[i];
+  if((flags & 15) == 15) *fen++ = '-';
+  *fen = 0;
+}
+
 char *
 MoveToText (int move)
 {
@@ -1666,7 +1297,6 @@ ParseMove(int stm, char *s)
       else if(f - f2 && !board[22*r+f]) m += 22*((r^1) - r + 5) + 11; // diagonal to empty: e.p.
     }
   }
-printf("# move = %08x\n", m);
   return m;
 }
 
@@ -1674,6 +1304,7 @@ printf("# move = %08x\n", m);
 int ponder;
 int resign;         // engine-defined option
 int contemptFactor; // likewise
+int numaInterleave; // likewise; takes effect on the next 'memory' command
 
 #ifdef WIN32 
 #    include <windows.h>
@@ -1681,7 +1312,19 @@ int contemptFactor; // likewise
 #else
 #    include <sys/time.h>
 #    include <sys/times.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <fcntl.h>
+#    include <sys/syscall.h>
 #    include <unistd.h>
+#    include <pthread.h>
+#    include <semaphore.h>
+#    include <sys/select.h>
+#    include <sys/socket.h>
+#    include <netinet/in.h>
+#    include <netdb.h>
+#    include <arpa/inet.h>
+#    include <sys/wait.h>
      int GetTickCount() // with thanks to Tord
      {	struct timeval t;
 	gettimeofday(&t, NULL);
@@ -1698,17 +1341,179 @@ ReadClock (int start)
   return t - startTime; // msec
 }
 
+#ifdef WIN32
 int
-SetMemorySize (int n)
+InputPending ()
 {
-  static int oldSize;
-  if(n == oldSize) return 0;       // nothing to do
-  oldSize = n;                     // remember current size
-  if(hashTable) free(hashTable);   // throw away old table
-  for(hashMask = (1<<26)-1; hashMask*sizeof(HashEntry) > n*1024*1024; hashMask >>= 1);    // round down nr of buckets to power of 2
-  hashTable = (HashEntry*) calloc(hashMask+4, sizeof(HashEntry));
-printf("# memory allocated, mask = %x\n", hashMask+1);
-  return !hashTable;               // return TRUE if alocation failed
+  return 0; // workers only exist on POSIX systems
+}
+#else
+int
+InputPending ()
+{ // stdin is unbuffered in worker mode, so select() sees everything that was not read yet
+  fd_set set; struct timeval t = { 0, 0 };
+  FD_ZERO(&set); FD_SET(0, &set);
+  return select(1, &set, NULL, NULL, &t) > 0;
+}
+#endif
+
+#define NR_COUNTERS 5
+
+char *counterName[NR_COUNTERS] = { "cycles", "instr", "L1d-miss", "LLC-miss", "br-miss" };
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+
+int counterFd[NR_COUNTERS] = { -1, -1, -1, -1, -1 };
+
+int
+CountersOpen ()
+{ // open the hardware counters for this thread (user mode only), as a group led by the cycle counter;
+  // returns how many exist, which can be 0 (no PMU in a VM, perf_event_paranoid too high, old kernel)
+  static int type[NR_COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+  static long long config[NR_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  struct perf_event_attr attr;
+  static int n;
+  int i;
+  if(counterFd[0] >= 0) return n; // already open
+  for(i=n=0; i<NR_COUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr); attr.type = type[i]; attr.config = config[i];
+    attr.exclude_kernel = attr.exclude_hv = 1;
+    counterFd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, counterFd[0], 0);
+    if(i == 0 && counterFd[0] < 0) return 0; // no cycle counter means no PMU at all
+    n += (counterFd[i] >= 0);                 // others can be missing on some CPUs; they then read as -1
+  }
+  return n;
+}
+
+void
+CountersRead (long long *count)
+{ // running totals; callers take differences
+  int i;
+  for(i=0; i<NR_COUNTERS; i++)
+    if(counterFd[i] < 0 || read(counterFd[i], count + i, sizeof(long long)) != sizeof(long long)) count[i] = -1;
+}
+#else
+int  CountersOpen () { return 0; }
+void CountersRead (long long *count) { int i; for(i=0; i<NR_COUNTERS; i++) count[i] = -1; }
+#endif
+
+#define HUGE_PAGE (2<<20)
+#define CLEAR_CHUNK (64<<20) /* tables up to this size are cleared by a single thread */
+
+#ifdef WIN32
+void *
+MapHash (size_t bytes)
+{ // large pages need the 'lock pages in memory' privilege, so fall back on normal ones
+  void *p = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  return p ? p : VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void *
+MapShared (size_t *bytes)
+{ // attach to the named table, or create it with the requested size; an existing table keeps its size
+  MEMORY_BASIC_INFORMATION info;
+  HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((unsigned long long) *bytes >> 32), (DWORD) *bytes, sharedName + 1);
+  void *p = (h ? MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL);
+  if(h) CloseHandle(h); // the view keeps the mapping alive
+  if(p && VirtualQuery(p, &info, sizeof(info))) *bytes = info.RegionSize;
+  return p;
+}
+
+#define UnmapHash(P, N) (sharedHash ? UnmapViewOfFile(P) : VirtualFree(P, 0, MEM_RELEASE))
+#define ClearHash() memset(hashTable, 0, hashBytes)
+#else
+void *
+MapHash (size_t bytes)
+{ // reserved huge pages if there are any, otherwise ask for transparent ones; optionally interleave over NUMA nodes
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if(p == MAP_FAILED) {
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+  }
+#ifdef SYS_mbind
+  if(numaInterleave) { // raw system calls, so we do not depend on libnuma
+    unsigned long nodes[16];
+    if(syscall(SYS_get_mempolicy, NULL, nodes, 8*sizeof(nodes), NULL, 0, 4 /* MPOL_F_MEMS_ALLOWED */) == 0)
+      syscall(SYS_mbind, p, bytes, 3 /* MPOL_INTERLEAVE */, nodes, 8*sizeof(nodes), 0);
+  }
+#endif
+  return p;
+}
+
+void *
+MapShared (size_t *bytes)
+{ // attach to the named table, or create it with the requested size; an existing table keeps its size
+  struct stat st; void *p;
+  int fd = shm_open(sharedName, O_RDWR | O_CREAT, 0600);
+  if(fd < 0) return NULL;
+  if(fstat(fd, &st) == 0 && st.st_size > 0) *bytes = st.st_size;
+  else if(ftruncate(fd, *bytes)) { close(fd); return NULL; }
+  p = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(p, *bytes, MADV_HUGEPAGE);
+#endif
+  return p;
+}
+
+#define UnmapHash(P, N) munmap(P, N)
+
+void *
+ClearPart (void *part)
+{ // zero one chunk of the hash table; the thread touching a page first also decides its NUMA node
+  size_t n = (size_t) part, start = n*CLEAR_CHUNK, len = hashBytes - start;
+  memset((char *) hashTable + start, 0, len < CLEAR_CHUNK ? len : CLEAR_CHUNK);
+  return NULL;
+}
+
+void
+ClearHash ()
+{ // zero the table with as many threads as there are cores, each taking the next chunk in turn
+  static pthread_t tid[64];
+  size_t chunks = (hashBytes + CLEAR_CHUNK - 1)/CLEAR_CHUNK, n, i, cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if(cores > 64) cores = 64;
+  for(n=0; n<chunks; n+=cores) {
+    size_t k = chunks - n < cores ? chunks - n : cores;
+    for(i=1; i<k; i++) if(pthread_create(tid + i, NULL, ClearPart, (void *) (n+i))) ClearPart((void *) (n+i)), tid[i] = 0;
+    ClearPart((void *) n); // do one chunk ourselves
+    for(i=1; i<k; i++) if(tid[i]) pthread_join(tid[i], NULL);
+  }
+}
+#endif
+
+int
+SetMemorySize (int n)
+{ // a private table that cannot get the requested size gets the largest smaller one that can be mapped
+  static char oldName[64];
+  if(n == hashMB && !strcmp(sharedName, oldName) && hashTable) return 0; // nothing to do
+  hashMB = n; strcpy(oldName, sharedName); // remember current size and name
+  if(hashTable) UnmapHash(hashTable, hashBytes), hashTable = NULL; // throw away old table
+  for(hashMask = ((Key)1<<40)-1; hashMask*sizeof(HashEntry) > (Key)n << 20; hashMask >>= 1); // round down nr of buckets to power of 2
+  hashBytes = ((hashMask+4)*sizeof(HashEntry) + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1); // whole number of huge pages
+  if(*sharedName) {                // the process that created the table decided its size
+    hashTable = (HashEntry*) MapShared(&hashBytes);
+    while((hashMask+4)*sizeof(HashEntry) > hashBytes) hashMask >>= 1;
+    while((2*hashMask+5)*sizeof(HashEntry) <= hashBytes) hashMask = 2*hashMask + 1;
+  } else {
+    while(!(hashTable = (HashEntry*) MapHash(hashBytes)) && hashMask > 1023) { // try ever smaller tables
+      hashMask >>= 1;
+      hashBytes = ((hashMask+4)*sizeof(HashEntry) + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+    }
+    if(hashTable) ClearHash();     // fresh mappings are zero already, but this faults the pages in in parallel
+  }
+  sharedHash = (hashTable && *sharedName);
+  return !hashTable;               // return TRUE if alocation failed (and there is no table at all)
 }
 
 int
@@ -1718,12 +1523,14 @@ RootMakeMove(int move)
   // irreversibly adopt incrementally updated values from last move as new starting point
   MoveStack m;
   int e = undoInfo.pstEval, checker;
+  GamePly *g = gameHistory + moveNr + 1;
+  if(moveNr >= gameLength || gameMove[moveNr] != move) gameLength = moveNr; // new move discards the redo tail
   gameMove[moveNr] = move; // remember game
   undoInfo.pstEval = -undoInfo.newEval; // (like we initialize new Stackframe in daughter node)
   undoInfo.hashKey = undoInfo.newKey;
   undoInfo.rights |= spoiler[undoInfo.fromSqr] | spoiler[undoInfo.toSqr];
   undoInfo.checker = CK_NONE; // make sure move will not be rejected
-  moveSP = 48;
+  moveSP = 48; m.epSqr = 255; // (an uninitialized e.p. square made MoveGen 'try' e.p. on an occupied square, and clear it)
   checker = (MoveGen(stm ^ COLOR, &m, undoInfo.rights) ? CK_DOUBLE : CK_NONE); // test if we are in check by generating opponent moves
   moveSP = 0; // and throw away those moves
   MakeMove(&undoInfo, move);
@@ -1733,26 +1540,970 @@ RootMakeMove(int move)
   // store in game history hash table
   index = (unsigned int)undoInfo.newKey >> 24 ^ stm << 2; // uses high byte of low (= hands-free) key
   while(repKey[index] && (repKey[index] ^ (int)undoInfo.newKey) & 0xFFFFF) index++; // find empty slot
+  g->repIndex = index; g->repKey = repKey[index]; g->repDep = repDep[index];
   repKey[index] = (int)undoInfo.newKey & 0xFFFFF | undoInfo.newEval << 20; // remember position
   repDep[index] = moveNr;
+  g->state = undoInfo;
   stm ^= COLOR; moveNr++;
+  if(moveNr > gameLength) gameLength = moveNr;
   return 1;
 }
 
 void
 TakeBack (int n)
-{ // reset the game and then replay it to the desired point
-  int last;
-  stm = Setup(NULL); // uses FEN saved during previous Setup
-  last = moveNr - n; if(last < 0) last = 0;
-  for(moveNr=0; moveNr<last; moveNr++) RootMakeMove(gameMove[moveNr]);
+{ // unmake the last n game moves, from the states RootMakeMove saved
+  while(n-- > 0 && moveNr > 0) {
+    GamePly *g = gameHistory + moveNr--;
+    UnMake(&g->state);
+    repKey[g->repIndex] = g->repKey; repDep[g->repIndex] = g->repDep; // (undone in reverse order of insertion)
+    undoInfo = g[-1].state; stm ^= COLOR;
+  }
 }
 
-void PrintResult(int stm, int score)
-{
-  if(score == 0) printf("1/2-1/2\n");
-  if(score > 0 && stm == WHITE || score < 0 && stm == BLACK) printf("1-0\n");
-  else printf("0-1\n");
+int
+GotoPly (int n)
+{ // take back or redo game moves until n have been played (as far as the game goes), one ply at the time
+  if(n < moveNr) TakeBack(moveNr - n);
+  while(moveNr < n && moveNr < gameLength) RootMakeMove(gameMove[moveNr]);
+  return moveNr;
+}
+
+void
+TraceDump ()
+{ // write the ring to the trace file, oldest node first, behind a header giving the variant and number of nodes
+  FILE *f = fopen(traceFile, "wb");
+  unsigned int n = (traceCount < traceSize ? traceCount : traceSize), i;
+  int header[3] = { 0x31525444 /* DTR1 */, variantNr, n };
+  if(!f) return;
+  fwrite(header, sizeof(int), 3, f);
+  for(i=traceCount-n; i<traceCount; i++) fwrite(traceBuf + i % traceSize, sizeof(TraceRecord), 1, f);
+  fclose(f);
+}
+
+int
+RootSearch (int depth)
+{ // clear the search tables and search the current game position
+  int i, score;
+  if(!sharedHash) ClearHash();     // a shared table holds the work of other processes
+  memset(qsTable, 0, sizeof(qsTable));
+  nodeCount = qsCount = forceMove = undoInfo.move = abortFlag = 0; ReadClock(1);
+  SetRootScore(0);                 // (the score of a move found by an earlier search must not stick)
+  for(i=0;i<1<<16;i++) history[i] = 0; //>>= 1;
+  for(i=0;i<1<<17;i++) mateKillers[i] = 0;
+  memset(dropHistory, 0, sizeof(dropHistory));
+  traceCount = 0;
+  score = (specialized ? SearchZH : Search)(stm^COLOR, -INF, INF, &undoInfo, depth, 0, depth);
+  if(traceSize) TraceNode(undoInfo.newKey, -INF, INF, -undoInfo.lim, score, depth, 0), TraceDump();
+  return score;
+}
+
+char *benchPositions[] = { // crazyhouse middlegames and Recycle positions with well-filled hands
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR[] w KQkq -",
+  "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R[] w KQkq -",
+  "r1bqk2r/ppp2ppp/2n2n2/3pp3/1b2P3/2NP1N2/PPP2PPP/R1BQKB1R[Pp] w KQkq -",
+  "r1b2rk1/pp1p1ppp/2n1pn2/q7/1bPP4/2N2N2/PP1BPPPP/R2QKB1R[Pp] w KQ -",
+  "r2qk2r/ppp2ppp/2np1n2/2b1p1B1/2B1P1b1/2NP1N2/PPP2PPP/R2QK2R[NBnb] w KQkq -",
+  "r3k2r/ppp1bppp/2n5/3q4/3P4/2P2N2/P4PPP/R2QR1K1[BNPPbnp] b kq -",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1[] w - -",
+  "r1b1k2r/pp3ppp/2p5/4P3/2B5/8/PP3PPP/R3K2R[NNBQnbbq] w KQkq -",
+  "6k1/5ppp/8/8/8/8/5PPP/6K1[QRRqrr] w - -",
+  NULL
+};
+
+void
+Bench (int depth)
+{ // fixed-depth search of the test positions, to measure search speed and tree size; the game survives it
+  static int saveMoves[MAXMOVES]; static char saveFEN[sizeof(startFEN)]; static unsigned char saveRecord[sizeof(rootRecord)];
+  int i, saveLeft = timeLeft, savePerMove = timePerMove, saveVariant = variantNr, saveXboard = xboard;
+  int saveLength = gameLength, saveNr = moveNr, savePacked = rootPacked;
+  long long int nodes = 0, qsNodes = 0, time = 0, start[NR_COUNTERS], end[NR_COUNTERS];
+  int counters = CountersOpen();
+  timePerMove = 0; timeLeft = 1<<26; // never run out of time
+  infoHook = NULL;                    // and do not report PVs
+  memcpy(saveMoves, gameMove, sizeof(gameMove)); strcpy(saveFEN, startFEN); memcpy(saveRecord, rootRecord, sizeof(rootRecord));
+  CountersRead(start);
+  for(i=0; benchPositions[i]; i++) {
+    GameInit(variants[0].name); stm = Setup(benchPositions[i]); moveNr = 0;
+    RootSearch(depth);
+    nodes += nodeCount; qsNodes += qsCount; time += ReadClock(0);
+    printf("# bench %d: %d nodes (%d QS) %d msec %s\n", i+1, nodeCount, qsCount, ReadClock(0), MoveToText(undoInfo.move));
+  }
+  printf("# bench depth %d: %lld nodes (%lld QS) %lld msec %lld nps\n", depth, nodes, qsNodes, time, 1000*nodes/(time+1));
+  CountersRead(end);
+  if(!counters) printf("# bench counters: not available\n"); else {
+    printf("# bench counters per node:");
+    for(i=0; i<NR_COUNTERS; i++) if(start[i] >= 0 && end[i] >= 0) printf(" %s %.1f", counterName[i], (end[i] - start[i])/(nodes + 1.));
+    if(start[1] >= 0) printf(" (IPC %.2f)", (end[1] - start[1])/(end[0] - start[0] + 1.));
+    printf("\n");
+  }
+  timeLeft = saveLeft; timePerMove = savePerMove;
+  xboard = 0; GameInit(variants[saveVariant].name); xboard = saveXboard; // (the GUI is still set up for it)
+  if(savePacked) UnpackRoot(saveRecord); else stm = Setup(saveFEN), moveNr = 0;
+  memcpy(gameMove, saveMoves, sizeof(gameMove)); gameLength = saveLength;
+  GotoPly(saveNr);                    // replay the game, keeping the moves that were taken back for redo
+}
+
+void
+PerftCommand (int depth)
+{ // count the nodes of the move tree of the current position to the given depth, for every depth up to it
+  int d, n;
+  for(d=1; d<=depth; d++) {
+    ReadClock(1); ply = 0;
+    n = (specialized ? PerftZH : Perft)(stm^COLOR, &undoInfo, d);
+    printf("# perft %d: %d nodes %d msec\n", d, n, ReadClock(0));
+  }
+}
+
+// files of packed positions: a header giving the variant and record size, followed by the records
+
+#define PACK_MAGIC 0x314B5044 /* DPK1 */
+
+struct DropperPackFile {
+  unsigned char *data; // the mapped file, header included
+  size_t size;
+  int count;
+};
+
+FILE *
+PackCreate (char *name)
+{ // open a file of packed positions for appending; a new one gets a header for the current variant
+  int header[4] = { PACK_MAGIC, variantNr, PackSize(), 0 }, old[4];
+  FILE *f = fopen(name, "rb");
+  if(f) { // existing file must be for the same variant
+    int n = fread(old, sizeof(old), 1, f);
+    fclose(f);
+    if(n && memcmp(old, header, sizeof(header))) return NULL;
+  }
+  if((f = fopen(name, "ab")) && fseek(f, 0, SEEK_END) == 0 && ftell(f) == 0 && fwrite(header, sizeof(header), 1, f) != 1) fclose(f), f = NULL;
+  return f;
+}
+
+int
+PackAppend (FILE *f)
+{ // add the game position (buffered by stdio, so records stream out in large writes)
+  unsigned char rec[11*11+2*16+2];
+  int n = PackPosition(rec);
+  return fwrite(rec, n, 1, f) == 1;
+}
+
+#ifdef WIN32
+void *
+MapFile (char *name, size_t *size)
+{
+  HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL), map;
+  LARGE_INTEGER n; void *p = NULL;
+  if(file == INVALID_HANDLE_VALUE) return NULL;
+  if(GetFileSizeEx(file, &n) && (*size = n.QuadPart) && (map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)))
+    p = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0), CloseHandle(map); // the view keeps the mapping alive
+  CloseHandle(file);
+  return p;
+}
+
+#define UnmapFile(P, N) UnmapViewOfFile(P)
+#else
+void *
+MapFile (char *name, size_t *size)
+{
+  struct stat st; void *p = MAP_FAILED;
+  int fd = open(name, O_RDONLY);
+  if(fd < 0) return NULL;
+  if(fstat(fd, &st) == 0 && (*size = st.st_size)) p = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if(p == MAP_FAILED) return NULL;
+#ifdef MADV_SEQUENTIAL
+  madvise(p, *size, MADV_SEQUENTIAL); // positions are mostly read in order
+#endif
+  return p;
+}
+
+#define UnmapFile(P, N) munmap(P, N)
+#endif
+
+DropperPackFile *
+PackOpen (char *name)
+{ // map a file of packed positions for reading, and switch to its variant; NULL if it is not such a file
+  DropperPackFile *f = (DropperPackFile *) calloc(1, sizeof(DropperPackFile));
+  VariantDesc *v; int *header;
+  if(!f || !(f->data = MapFile(name, &f->size))) { free(f); return NULL; }
+  header = (int *) f->data;
+  if(f->size < 16 || header[0] != PACK_MAGIC || header[1] < 0 || header[1] > TORI_NR) { UnmapFile(f->data, f->size); free(f); return NULL; }
+  v = variants + header[1];
+  if(header[2] != v->files*v->ranks + 2*v->hand + 2) { UnmapFile(f->data, f->size); free(f); return NULL; } // PackSize() of that variant
+  if(header[1] != variantNr) GameInit(v->name), rootPacked = 0;
+  f->count = (f->size - 16) / header[2];
+  return f;
+}
+
+unsigned char *
+PackRecord (DropperPackFile *f, int n)
+{
+  return (n >= 0 && n < f->count ? f->data + 16 + (size_t) n*PackSize() : NULL);
+}
+
+void
+PackClose (DropperPackFile *f)
+{
+  UnmapFile(f->data, f->size); free(f);
+}
+
+int
+PackCommand (char *args, int load)
+{ // pack FILE: append the game position to FILE; unpack FILE N: set up position N from it
+  char name[256]; int n = 0, ok = 0;
+  if(sscanf(args, "%255s %d", name, &n) < 1 + load) return 0;
+  if(load) {
+    DropperPackFile *f = PackOpen(name);
+    if(f && PackRecord(f, n)) ok = UnpackRoot(PackRecord(f, n));
+    if(f) PackClose(f);
+  } else {
+    FILE *f = PackCreate(name);
+    if(f) ok = PackAppend(f), ok &= !fclose(f);
+  }
+  return ok;
+}
+
+// library interface (see dropper.h)
+
+struct DropperSearch {
+  int depth, msec, score, pvScore, move;
+  volatile int done;
+  char bestMove[20];
+#ifdef WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+};
+
+DropperSearch rootSearch; // the game state is global, so there can only be one search at the time
+int searchLive;           // from DropperGo until DropperWait: the search thread owns game state, move stack and hash
+
+int
+XboardScore (int score)
+{ // mate scores as 100000 + distance
+  return (score > INF-100 ? 100000 + INF - score : score < 100-INF ? -100000 - score - INF : score);
+}
+
+void
+ReportInfo (int depth, int score, char *pv)
+{ // pass a new root PV to whoever started the search
+  rootSearch.pvScore = score;
+  if(infoHook) infoHook(infoClosure, depth, score, ReadClock(0), nodeCount, pv);
+}
+
+void
+SetRootScore (int score)
+{ // the score that goes with the best root move so far, for when that move does not come with a PV (ReportInfo)
+  rootSearch.pvScore = score;
+}
+
+void
+ReportPV (int depth, int score, int *pv)
+{
+  char buf[10*MAXPLY], *p = buf;
+  for(*p = 0; *pv; pv++) p += sprintf(p, " %s", MoveToText(*pv));
+  ReportInfo(depth, score, buf + (*buf == ' '));
+}
+
+int
+RootMoves (int *list)
+{ // collect the moves Perft would play in the game position
+  MoveStack m; StackFrame f;
+  int i, n = 0;
+  f.hashKey = undoInfo.newKey;
+  f.pstEval = -undoInfo.newEval;
+  f.rights  =  undoInfo.rights | spoiler[undoInfo.toSqr] | spoiler[undoInfo.fromSqr];
+  m.epSqr   =  undoInfo.epSqr;
+  RootCheck(stm, &f);
+  moveSP = 48; ply = 0;
+  if(!MoveGen(stm, &m, f.rights)) {
+    if(f.checker != CK_NONE) moveSP = m.castlings; // no castling out of check
+    AllDrops(stm);
+    for(i=m.firstMove; i<moveSP; i++) if(MakeMove(&f, moveStack[i])) UnMake(&f), list[n++] = moveStack[i] & 0xFFFF;
+  }
+  moveSP = 0;
+  return n;
+}
+
+int
+GameMoveIsLegal (int move)
+{
+  int list[MAXMOVES], n = RootMoves(list);
+  while(--n >= 0) if(list[n] == (move & 0xFFFF)) return 1;
+  return 0;
+}
+
+int
+TraceCommand (char *args)
+{ // FILE SIZE [MOVE...]: record the last SIZE nodes of every search below the given root moves; nothing = stop
+  char move[20]; int n, size = 0, m, saveLength = gameLength, saveMoves[MAXPLY];
+  int room = (MAXMOVES - 1 - moveNr < MAXPLY ? MAXMOVES - 1 - moveNr : MAXPLY);
+  free(traceBuf); traceBuf = NULL; traceSize = tracePly = 0;
+  if(sscanf(args, "%255s %d%n", traceFile, &size, &n) < 2 || size <= 0) return 0;
+  if(!(traceBuf = (TraceRecord *) malloc(size*sizeof(TraceRecord)))) return 0;
+  memcpy(saveMoves, gameMove + moveNr, room*sizeof(int));
+  for(args += n; sscanf(args, "%19s%n", move, &n) == 1 && tracePly < room; args += n) {
+    m = ParseMove(stm, move);
+    if(!GameMoveIsLegal(m)) break;
+    tracePath[tracePly++] = m & 0xFFFF; RootMakeMove(m); // play it, so the next one parses in the right position
+  }
+  TakeBack(tracePly);
+  memcpy(gameMove + moveNr, saveMoves, room*sizeof(int)); gameLength = saveLength; // the path is no part of the game
+  traceSize = size;
+  return size;
+}
+
+// distributed search: a coordinator farms out the root moves to worker processes ('dropper worker [IP:]PORT'),
+// which are ordinary xboard engines talking over a TCP connection, that also understand 'search' and 'stop'
+
+#define MAXWORKERS 64
+
+typedef struct {
+  int fd, nr, lo, hi; // connection, and the root move it searches (-1 = idle) with the window it got
+  char buf[4096], *end; // received text not yet processed
+} Worker;
+
+Worker workers[MAXWORKERS+1]; // the last one stands for the coordinator itself, when no workers are left
+int nrWorkers;
+
+#define LOCAL (workers + MAXWORKERS)
+
+void
+SearchOneMove (int move, int depth, int alpha, int beta, char *buf)
+{ // search the game position with only the given root move, and put the result line with the bounds on its score in buf
+  int upper, i;
+  char *p = buf + sprintf(buf, "result %s ", MoveToText(move));
+  nodeCount = qsCount = undoInfo.move = abortFlag = 0;
+  rootOnly = move & 0xFFFF;
+  upper = (specialized ? SearchZH : Search)(stm^COLOR, alpha, beta, &undoInfo, depth, 0, depth);
+  rootOnly = 0;
+  if(abortFlag) { strcpy(p, "aborted\n"); return; }
+  p += sprintf(p, "%d %d %d", -undoInfo.lim, upper, nodeCount);
+  for(i = 0; pvStack[i]; i++) p += sprintf(p, " %s", MoveToText(pvStack[i])); // root PV, if score was inside window
+  strcpy(p, "\n");
+}
+
+void
+SearchRootMove (char *text, int depth, int alpha, int beta)
+{ // worker side: search the game position with only the given root move, and report the bounds on its score
+  int move = ParseMove(stm, text), saveLeft = timeLeft, savePerMove = timePerMove;
+  char buf[10*MAXPLY+100];
+  if(!GameMoveIsLegal(move)) { printf("result %s illegal\n", text); return; }
+  timePerMove = 0; timeLeft = 1<<26; // only the coordinator stops us
+  ReadClock(1); infoHook = NULL;
+  SearchOneMove(move, depth, alpha, beta, buf);
+  timeLeft = saveLeft; timePerMove = savePerMove;
+  printf("%s", buf);
+}
+
+#ifdef WIN32
+int
+DropperCluster (const char *addresses)
+{
+  return 0; // needs POSIX sockets
+}
+
+int
+ClusterSearch (int depth)
+{
+  return RootSearch(depth);
+}
+#else
+#ifndef MSG_NOSIGNAL
+#    define MSG_NOSIGNAL 0
+#endif
+
+int
+ServeWorker (char *address)
+{ // wait for a coordinator to connect at [IP:]PORT, and make the connection our stdin and stdout; as the coordinator
+  // gets full command access, we only listen on the loopback interface unless told otherwise (0.0.0.0 = everywhere)
+  struct sockaddr_in a; int s, c = -1, on = 1, port; char host[64] = "127.0.0.1";
+  memset(&a, 0, sizeof(a)); a.sin_family = AF_INET;
+  if(strchr(address, ':') ? sscanf(address, "%63[^:]:%d", host, &port) != 2 : sscanf(address, "%d", &port) != 1) return 1;
+  if(inet_pton(AF_INET, host, &a.sin_addr) != 1) return 1;
+  a.sin_port = htons(port);
+  s = socket(AF_INET, SOCK_STREAM, 0);
+  if(s >= 0) setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if(s < 0 || bind(s, (struct sockaddr *) &a, sizeof(a)) || listen(s, 1) || (c = accept(s, NULL, NULL)) < 0) return 1;
+  close(s); dup2(c, 0); dup2(c, 1); close(c);
+  setvbuf(stdin, NULL, _IONBF, 0); // so that InputPending sees everything we have not read yet
+  workerMode = 1;
+  return 0;
+}
+
+int
+ConnectWorker (char *address)
+{ // open a connection to a worker at host:port
+  struct addrinfo hints, *res, *r; char host[100], port[20]; int fd = -1;
+  if(sscanf(address, "%99[^:]:%19s", host, port) != 2) return -1;
+  memset(&hints, 0, sizeof(hints)); hints.ai_socktype = SOCK_STREAM;
+  if(getaddrinfo(host, port, &hints, &res)) return -1;
+  for(r=res; r && fd < 0; r=r->ai_next) {
+    fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+    if(fd >= 0 && connect(fd, r->ai_addr, r->ai_addrlen)) close(fd), fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+int
+DropperCluster (const char *addresses)
+{
+  char buf[100]; int n;
+  while(nrWorkers) close(workers[--nrWorkers].fd);
+  while(nrWorkers < MAXWORKERS && sscanf(addresses, " %99s%n", buf, &n) == 1) {
+    addresses += n;
+    if((workers[nrWorkers].fd = ConnectWorker(buf)) >= 0) nrWorkers++;
+  }
+  return nrWorkers;
+}
+
+void
+Send (Worker *w, char *text)
+{ // a worker that went away just stops getting work
+  if(w->fd >= 0 && send(w->fd, text, strlen(text), MSG_NOSIGNAL) < 0) close(w->fd), w->fd = -1;
+}
+
+void
+SyncWorkers ()
+{ // give all workers the game position
+  char buf[600]; int i, j;
+  if(rootPacked) RecordToFEN(rootRecord, startFEN), rootPacked = 0;
+  for(i=0; i<nrWorkers; i++) {
+    Worker *w = workers + i;
+    snprintf(buf, sizeof(buf), "new\nforce\nvariant %ssetboard %s%s", variants[variantNr].name, startFEN, strchr(startFEN, '\n') ? "" : "\n");
+    Send(w, buf);
+    for(j=0; j<moveNr; j++) sprintf(buf, "usermove %s\n", MoveToText(gameMove[j])), Send(w, buf);
+    w->nr = -1; w->end = w->buf;
+  }
+}
+
+void
+Dispatch (Worker *w, int nr, int move, int depth, int lo, int hi)
+{
+  char buf[80];
+  w->nr = nr; w->lo = lo; w->hi = hi;
+  if(w == LOCAL) { // search it ourselves, and leave the result as if a worker had sent it
+    int saveNodes = nodeCount, saveMove = undoInfo.move, saveScore = rootSearch.pvScore;
+    DropperInfo *saveHook = infoHook;
+    infoHook = NULL; SearchOneMove(move, depth, lo, hi, w->end); w->end += strlen(w->end);
+    nodeCount = saveNodes; undoInfo.move = saveMove; rootSearch.pvScore = saveScore; infoHook = saveHook;
+    return;
+  }
+  sprintf(buf, "search %s %d %d %d\n", MoveToText(move), depth, lo, hi);
+  Send(w, buf);
+}
+
+int
+WorkerResult (Worker *w, char *line)
+{ // extract the next complete result from what the worker sent; other lines are its xboard chatter
+  char *p;
+  while((p = memchr(w->buf, '\n', w->end - w->buf))) {
+    int len = p + 1 - w->buf, result = !strncmp(w->buf, "result ", 7);
+    if(result) memcpy(line, w->buf, len - 1), line[len - 1] = 0;
+    memmove(w->buf, p + 1, w->end - p - 1); w->end -= len;
+    if(result) return 1;
+  }
+  if(w->end == w->buf + sizeof(w->buf)) w->end = w->buf; // overlong line; cannot be a result
+  return 0;
+}
+
+int
+ClusterSearch (int depth)
+{ // root split: in each iteration the first move is searched alone with an open window (young brothers wait),
+  // and then the others go to whichever worker is idle with a null window, biggest subtrees of the previous
+  // iteration first; moves that fail high are re-searched with an open window. The move of a worker that
+  // goes away (or answers nonsense) goes to another, or when none are left, is searched by the coordinator
+  int list[MAXMOVES], nodes[MAXMOVES], redo[MAXMOVES], scout[MAXMOVES], n, nrRedo, nrScout, d, i, next, busy, alpha = -INF, best, stop = 0;
+  char line[sizeof(workers[0].buf)];
+  Worker *w, *last;
+  n = RootMoves(list);
+  if(n == 0) return RootSearch(1); // (stale)mate; let the normal search score it
+  SyncWorkers(); ReadClock(1);
+  LOCAL->fd = -1; LOCAL->nr = -1; LOCAL->end = LOCAL->buf;
+  nodeCount = qsCount = rootSearch.pvScore = 0; undoInfo.move = list[0];
+  for(i=0; i<n; i++) nodes[i] = 0;
+  for(d=1; d<=depth && !stop && (d == 1 || !TimeIsUp(1)); d++) {
+    for(i=2; i<n; i++) { // sort all but the best move on the size of their subtree
+      int move = list[i], size = nodes[i], j = i;
+      while(j > 1 && nodes[j-1] < size) list[j] = list[j-1], nodes[j] = nodes[j-1], j--;
+      list[j] = move; nodes[j] = size;
+    }
+    for(i=0; i<n; i++) nodes[i] = 0;
+    alpha = -INF; best = -1; next = nrRedo = nrScout = busy = 0;
+    while(busy || (!stop && (next < n || nrRedo || nrScout))) {
+      fd_set set; struct timeval t = { 0, 10000 }; int max = 0, ready, j;
+      for(w=workers; w<workers+nrWorkers && w->fd < 0; w++) {}
+      last = (w < workers+nrWorkers ? workers+nrWorkers : LOCAL+1); // when all workers are gone we search ourselves
+      if(last == LOCAL+1) w = LOCAL;
+      for(; w<last && !stop; w++) if((w->fd >= 0 || w == LOCAL) && w->nr < 0) { // hand out work to idle workers
+	if(nrRedo) i = redo[--nrRedo], Dispatch(w, i, list[i], d, alpha, INF), busy++;
+	else if(next == 0) Dispatch(w, next, list[next], d, -INF, INF), next++, busy++;
+	else if(best >= 0 && nrScout) i = scout[--nrScout], Dispatch(w, i, list[i], d, alpha, alpha+1), busy++;
+	else if(best >= 0 && next < n) Dispatch(w, next, list[next], d, alpha, alpha+1), next++, busy++;
+      }
+      FD_ZERO(&set);
+      for(w=workers; w<workers+nrWorkers; w++) if(w->fd >= 0 && w->nr >= 0) FD_SET(w->fd, &set), max = (w->fd > max ? w->fd : max);
+      if(LOCAL->nr >= 0) t.tv_usec = 0; // our own result is already there, so do not wait for the others
+      ready = select(max + 1, &set, NULL, NULL, &t);
+      for(j=0; j<=nrWorkers; j++) if(w = (j < nrWorkers ? workers + j : LOCAL), w->nr >= 0 && (w == LOCAL || (w->fd >= 0 && ready > 0 && FD_ISSET(w->fd, &set)))) {
+	int lower, upper, count, k = 0;
+	if(w != LOCAL) {
+	  int r = read(w->fd, w->end, w->buf + sizeof(w->buf) - w->end); // r <= 0: lost the worker
+	  if(r > 0 && (w->end += r, !WorkerResult(w, line))) continue;
+	  if(r <= 0 || sscanf(line, "result %*s %d %d %d %n", &lower, &upper, &count, &k) < 3) {
+	    i = w->nr; w->nr = -1; busy--;
+	    if(r > 0 && stop) continue; // (an aborted search, after we called it back)
+	    close(w->fd); w->fd = -1;   // a worker that does not give results is of no use
+	    if(stop) continue;
+	    if(w->hi == w->lo + 1) scout[nrScout++] = i; else if(best < 0) next = 0; else redo[nrRedo++] = i;
+	    continue;
+	  }
+	} else if(!WorkerResult(w, line)) continue;
+	i = w->nr; w->nr = -1; busy--;
+	if(w == LOCAL && sscanf(line, "result %*s %d %d %d %n", &lower, &upper, &count, &k) < 3) { stop = 1; continue; } // out of time
+	nodeCount += count; nodes[i] += count;
+	if(w->hi == w->lo + 1) { if(lower > alpha) redo[nrRedo++] = i; } // scout failed high: get exact score
+	else if(lower > alpha || i == 0) { // (first) move has new best score
+	  alpha = lower; best = i; undoInfo.move = list[i];
+	  ReportInfo(d, XboardScore(lower), line + k);
+	}
+      }
+      if(!stop && (stopSearch || TimeIsUp(3))) { // out of time: call back the workers
+	stop = 1;
+	for(w=workers; w<workers+nrWorkers; w++) if(w->nr >= 0) Send(w, "stop\n");
+      }
+    }
+    if(best > 0) i = list[best], list[best] = list[0], list[0] = i, i = nodes[best], nodes[best] = nodes[0], nodes[0] = i; // best in front
+  }
+  return alpha;
+}
+#endif
+
+// game review: every position of the game is searched to a fixed depth or time, the last one first, so that the
+// hash table passes what it learned on to the earlier ones; forked processes that share the table take turns
+
+typedef struct {
+  int score, move, nodes; // for the position before game move i: score for the side to move, best move, tree size
+} ReviewPly;
+
+void
+ReviewPosition (ReviewPly *r, int i, int depth)
+{
+  GotoPly(i);
+  r[i].score = XboardScore(RootSearch(depth)); r[i].move = undoInfo.move;
+  if(r[i].move) r[i].score = rootSearch.pvScore; // (as in SearchThread)
+  r[i].nodes = (*reviewStop ? -1 : nodeCount); // a search cut short does not count as reviewed
+}
+
+void
+ReviewPositions (ReviewPly *r, volatile int *next, int depth)
+{ // claim positions from the end of the game backwards, until none are left
+  int i;
+  while(!*reviewStop && (i = __sync_fetch_and_sub(next, 1)) >= 0) ReviewPosition(r, i, depth);
+}
+
+int
+PlayedScore (ReviewPly *r, int i)
+{ // score of game move i for the side that played it: the score of the position it led to, one ply further away
+  int score = -r[i+1].score;
+  if((r[i].move & 0xFFFF) == (gameMove[i] & 0xFFFF)) return r[i].score; // best move; do not compare depths
+  if(r[i+1].nodes < 0) return 0;                       // not known: the review was stopped before it got there
+  return score + (score > 100000) - (score < -100000);
+}
+
+int
+Review (int depth, int msec, ReviewPly *result)
+{ // search the positions before each move of the game, and after the last; returns how many processes did it.
+  // DropperStop (or with reviewInput, new input) stops it early, leaving the positions not done with nodes = -1
+  int n = moveNr, i, procs = 1, saveLeft = timeLeft, savePerMove = timePerMove, saveShared = sharedHash;
+  volatile int next = n, stop = 0;
+  if(depth <= 0 || depth > MAXPLY-2) depth = MAXPLY-2; // no limit
+  timePerMove = 0; timeLeft = (msec > 0 ? (msec + 30)/10 : 1<<26); // fixed time, or never run out
+  infoHook = NULL; stopSearch = 0; reviewStop = &stop;
+  for(i=0; i<=n; i++) result[i].nodes = -1, result[i].move = result[i].score = 0;
+  if(!sharedHash) ClearHash();     // once; the positions must keep each others' work
+  sharedHash = 1;
+#ifdef WIN32
+  ReviewPositions(result, &next, depth); // the game state is global, so threads cannot do this
+#else
+  {
+    size_t bytes = (n+1)*sizeof(ReviewPly) + 2*sizeof(int);
+    HashEntry *saveTable = hashTable, *h = hashTable;
+    ReviewPly *r = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    volatile int *counter = (volatile int *) (r + n + 1);
+    pid_t pid[MAXWORKERS];
+    procs = sysconf(_SC_NPROCESSORS_ONLN);
+    if(procs > n + 1) procs = n + 1;
+    if(procs > MAXWORKERS) procs = MAXWORKERS;
+    if(r == MAP_FAILED) procs = 1, r = result, counter = &next;
+    else reviewStop = counter + 1;
+    if(procs > 1 && !saveShared) { // a private table is replaced by a shared one for the duration of the review
+      h = mmap(NULL, hashBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if(h == MAP_FAILED) procs = 1; else hashTable = h;
+    }
+    memcpy(r, result, (n+1)*sizeof(ReviewPly)); *counter = n;
+    fflush(stdout);
+    for(i=1; i<procs; i++) if((pid[i] = fork()) == 0) { // child: no output, and leave without flushing stdio
+      ReviewPositions(r, counter, depth);
+      _exit(0);
+    }
+    ReviewPositions(r, counter, depth);
+    for(i=1; i<procs; i++) if(pid[i] > 0) waitpid(pid[i], NULL, 0);
+    for(i=n; i>=0 && !*reviewStop; i--) if(r[i].nodes < 0) ReviewPosition(r, i, depth); // claimed by a process that failed
+    if(r != result) memcpy(result, r, (n+1)*sizeof(ReviewPly)), munmap(r, bytes);
+    if(h != saveTable) munmap(h, hashBytes), hashTable = saveTable;
+  }
+#endif
+  sharedHash = saveShared; reviewStop = NULL;
+  timeLeft = saveLeft; timePerMove = savePerMove;
+  GotoPly(n);
+  return procs;
+}
+
+void
+ReviewCommand (int depth, int msec)
+{ // report the best move and score of every position of the game, and the score of the move that was played
+  static ReviewPly r[MAXMOVES+1];
+  int i, t, procs, done = 0;
+  long long nodes = 0;
+  t = GetTickCount();
+  reviewInput = 1; procs = Review(depth, msec, r); reviewInput = 0;
+  for(i=0; i<=moveNr; i++) {
+    char best[20];
+    if(r[i].nodes < 0) { printf("# review %d: stopped\n", i); continue; }
+    strcpy(best, r[i].move ? MoveToText(r[i].move) : "-");
+    nodes += r[i].nodes; done++;
+    if(i == moveNr) printf("# review %d: - best %s %d\n", i, best, r[i].score);
+    else printf("# review %d: %s %d best %s %d\n", i, MoveToText(gameMove[i]), PlayedScore(r, i), best, r[i].score);
+  }
+  printf("# review: %d positions %lld nodes %d msec %d processes\n", done, nodes, GetTickCount() - t, procs);
+}
+
+#ifdef WIN32
+DWORD WINAPI
+SearchThread (LPVOID arg)
+#else
+void *
+SearchThread (void *arg)
+#endif
+{ // searches the game position on behalf of DropperGo
+  DropperSearch *s = arg;
+  int saveLeft = timeLeft, savePerMove = timePerMove;
+  if(s->msec >= 0) timePerMove = 0, timeLeft = (s->msec ? (s->msec + 30)/10 : 1<<26); // fixed time, or never run out
+  s->score = (nrWorkers ? ClusterSearch : RootSearch)(s->depth); // meaningless when aborted
+  s->move = undoInfo.move;
+  if(s->move) s->score = s->pvScore; // so take it from the PV that made the move best
+  timeLeft = saveLeft; timePerMove = savePerMove;
+  s->done = 1;
+  return 0;
+}
+
+int
+DropperInit (int hashMB)
+{
+  EngineInit();
+  GameInit("zh"); stm = Setup(startPos); moveNr = 0;
+  return SetMemorySize(hashMB);
+}
+
+int
+DropperMemory (int hashMB)
+{
+  if(searchLive) return 1;
+  return SetMemorySize(hashMB);
+}
+
+int
+DropperShareHash (const char *name)
+{
+  if(searchLive) return 1;
+  snprintf(sharedName, sizeof(sharedName), "%s%s", *name && *name != '/' ? "/" : "", name);
+  if(!SetMemorySize(hashMB)) return 0;
+  *sharedName = 0; SetMemorySize(hashMB); // fall back on a private table
+  return 1;
+}
+
+void
+DropperVariant (const char *name)
+{
+  if(searchLive) return;
+  char buf[80];
+  snprintf(buf, sizeof(buf) - 1, "%s", name);
+  if(!strchr(buf, '\n')) strcat(buf, "\n"); // variant table has names as xboard sends them
+  GameInit(buf); stm = Setup(startPos); moveNr = 0;
+}
+
+void
+DropperSetup (const char *fen)
+{
+  if(searchLive) return;
+  stm = Setup((char *) fen); moveNr = 0;
+}
+
+int
+DropperMove (const char *move)
+{
+  if(searchLive) return 0;
+  int m = ParseMove(stm, (char *) move);
+  return GameMoveIsLegal(m) && RootMakeMove(m);
+}
+
+void
+DropperUndo (int n)
+{
+  if(searchLive) return;
+  TakeBack(n);
+}
+
+int
+DropperGoto (int ply)
+{
+  if(searchLive) return moveNr;
+  return GotoPly(ply);
+}
+
+int
+DropperPackSize ()
+{
+  return PackSize();
+}
+
+int
+DropperPack (unsigned char *rec)
+{
+  if(searchLive) return 0;
+  return PackPosition(rec);
+}
+
+int
+DropperUnpack (const unsigned char *rec)
+{
+  if(searchLive) return 0;
+  return UnpackRoot((unsigned char *) rec) != 0;
+}
+
+DropperPackFile *
+DropperPackOpen (const char *name, int *count)
+{
+  DropperPackFile *f = (searchLive ? NULL : PackOpen((char *) name)); // (it can switch variant)
+  if(count) *count = (f ? f->count : 0);
+  return f;
+}
+
+const unsigned char *
+DropperPackRecord (DropperPackFile *f, int n)
+{
+  return PackRecord(f, n);
+}
+
+void
+DropperPackClose (DropperPackFile *f)
+{
+  PackClose(f);
+}
+
+FILE *
+DropperPackCreate (const char *name)
+{
+  return PackCreate((char *) name);
+}
+
+int
+DropperPackAppend (FILE *f)
+{
+  if(searchLive) return 0;
+  return PackAppend(f);
+}
+
+int
+DropperReview (int depth, int msec, DropperPly *plies)
+{
+  if(searchLive) return 0;
+  static ReviewPly r[MAXMOVES+1];
+  int i;
+  Review(depth, msec, r);
+  for(i=0; i<=moveNr; i++) {
+    plies[i].score = r[i].score;
+    plies[i].played = (i < moveNr ? PlayedScore(r, i) : 0);
+    strcpy(plies[i].best, r[i].move ? MoveToText(r[i].move) : "");
+    plies[i].nodes = (r[i].nodes < 0 ? 0 : r[i].nodes);
+  }
+  return moveNr + 1;
+}
+
+DropperSearch *
+DropperGo (int depth, int msec, DropperInfo *info, void *closure)
+{
+  DropperSearch *s = &rootSearch;
+  if(searchLive) return NULL; // only one search at the time
+  s->depth = (depth > 0 && depth < MAXPLY-2 ? depth : MAXPLY-2);
+  s->msec = msec; s->done = stopSearch = s->pvScore = 0;
+  infoHook = info; infoClosure = closure;
+  searchLive = 1;
+#ifdef WIN32
+  if(!(s->thread = CreateThread(NULL, 0, SearchThread, s, 0, NULL))) return searchLive = 0, NULL;
+#else
+  if(pthread_create(&s->thread, NULL, SearchThread, s)) return searchLive = 0, NULL;
+#endif
+  return s;
+}
+
+int
+DropperPoll (DropperSearch *s)
+{
+  return s->done;
+}
+
+void
+DropperStop (DropperSearch *s)
+{
+  stopSearch = 1;
+}
+
+const char *
+DropperWait (DropperSearch *s, int *score)
+{
+#ifdef WIN32
+  WaitForSingleObject(s->thread, INFINITE); CloseHandle(s->thread);
+#else
+  pthread_join(s->thread, NULL);
+#endif
+  searchLive = 0;
+  if(score) *score = s->score;
+  return (s->move ? strcpy(s->bestMove, MoveToText(s->move)) : NULL);
+}
+
+// xboard client
+
+// The search thread only formats thinking output into a ring of lines, which a separate thread writes to
+// stdout. So a GUI that is slow to read its pipe cannot stall the search. The ring has a single producer
+// (the search thread, or the main thread when no search runs) and a single consumer, so it needs no lock.
+
+#ifdef WIN32
+typedef HANDLE Semaphore;
+#  define SemInit(S) (S = CreateSemaphore(NULL, 0, 1<<30, NULL))
+#  define SemPost(S) ReleaseSemaphore(S, 1, NULL)
+#  define SemWait(S) WaitForSingleObject(S, INFINITE)
+#  define SemWaitMs(S, T) WaitForSingleObject(S, T)
+typedef CRITICAL_SECTION Lock;
+#  define LockInit(L) InitializeCriticalSection(&L)
+#  define Acquire(L)  EnterCriticalSection(&L)
+#  define Release(L)  LeaveCriticalSection(&L)
+#else
+typedef sem_t Semaphore;
+#  define SemInit(S) sem_init(&S, 0, 0)
+#  define SemPost(S) sem_post(&S)
+#  define SemWait(S) sem_wait(&S)
+#  define SemWaitMs(S, T) SemTimedWait(&S, T)
+typedef pthread_mutex_t Lock;
+#  define LockInit(L) pthread_mutex_init(&L, NULL)
+#  define Acquire(L)  pthread_mutex_lock(&L)
+#  define Release(L)  pthread_mutex_unlock(&L)
+
+void
+SemTimedWait (sem_t *s, int msec)
+{ // wait at most msec for the semaphore
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  t.tv_nsec += (msec % 1000)*1000000; t.tv_sec += msec/1000 + t.tv_nsec/1000000000; t.tv_nsec %= 1000000000;
+  sem_timedwait(s, &t);
+}
+#endif
+
+#define OUT_LINES 64
+#define OUT_WIDTH (10*MAXPLY+50)
+
+char outRing[OUT_LINES][OUT_WIDTH];
+volatile unsigned int outHead, outTail; // advanced by the producer and by the output thread, respectively
+Semaphore outQueued, outDrained;       // wake up the output thread, and whoever waits for it to finish
+char heldPV[OUT_WIDTH];                 // latest thinking output that the rate limit held back
+int pvDepth = -1, pvTime;               // depth and (wall-clock) time of the last thinking output sent
+Lock heldLock;                          // heldPV, pvDepth and pvTime are shared with the output thread
+int pvInterval = 100;                   // msec between thinking-output lines of the same depth
+int echoCommands;                       // debug option: echo every command as a comment
+
+int
+QueueLine (char *line)
+{ // never waits for the output thread; returns 0 if the ring is full
+  if(outHead - outTail >= OUT_LINES) return 0;
+  strcpy(outRing[outHead % OUT_LINES], line);
+  __sync_synchronize(); // the line must be complete before the output thread can see it
+  outHead++; SemPost(outQueued);
+  return 1;
+}
+
+#ifdef WIN32
+DWORD WINAPI
+OutputThread (LPVOID arg)
+#else
+void *
+OutputThread (void *arg)
+#endif
+{ // writes the queued lines, and a held-back PV once pvInterval has passed (so it cannot hang around for long)
+  char held[OUT_WIDTH];
+  while(1) {
+    int wait;
+    Acquire(heldLock); wait = (*heldPV ? pvTime + pvInterval - GetTickCount() : -1); Release(heldLock);
+    if(wait < 0) SemWait(outQueued); else if(wait > 0) SemWaitMs(outQueued, wait);
+    while(outTail != outHead) {
+      __sync_synchronize(); // (read the line only after seeing it queued)
+      fputs(outRing[outTail % OUT_LINES], stdout);
+      __sync_synchronize(); // and release its slot only after reading it
+      outTail++;
+    }
+    *held = 0;             // anything still held back is newer than what was queued
+    Acquire(heldLock);
+    if(*heldPV && GetTickCount() - pvTime >= pvInterval) strcpy(held, heldPV), *heldPV = 0, pvTime = GetTickCount();
+    Release(heldLock);
+    fputs(held, stdout);
+    fflush(stdout);
+    SemPost(outDrained);
+  }
+  return 0;
+}
+
+int
+StartOutput ()
+{ // returns 0 on success
+#ifdef WIN32
+  SemInit(outQueued); SemInit(outDrained); LockInit(heldLock);
+  return !CreateThread(NULL, 0, OutputThread, NULL, 0, NULL);
+#else
+  pthread_t thread;
+  SemInit(outQueued); SemInit(outDrained); LockInit(heldLock);
+  return pthread_create(&thread, NULL, OutputThread, NULL);
+#endif
+}
+
+void
+FlushOutput ()
+{ // after a search: queue the thinking output that was held back, and wait until all of it is written
+  char held[OUT_WIDTH];
+  Acquire(heldLock); strcpy(held, heldPV); *heldPV = 0; pvDepth = -1; Release(heldLock); // (the output thread needs it to drain)
+  if(*held) while(!QueueLine(held)) SemWait(outDrained);
+  while(outTail != outHead) SemWait(outDrained);
+}
+
+void
+PrintPV (void *closure, int depth, int score, int msec, int nodes, const char *pv)
+{ // thinking output. A new PV of the same depth within pvInterval replaces the one held back, if any;
+  // that goes out before the first PV of the next depth (so every depth ends with its final PV), or when
+  // the output thread sees pvInterval has passed
+  char line[OUT_WIDTH]; int now = GetTickCount();
+  snprintf(line, OUT_WIDTH, "%d %d %d %d%s%s\n", depth, score, msec/10, nodes, *pv ? " " : "", pv);
+  Acquire(heldLock);
+  if(depth != pvDepth && *heldPV && QueueLine(heldPV)) *heldPV = 0;
+  if((depth == pvDepth && now - pvTime < pvInterval) || !QueueLine(line)) strcpy(heldPV, line), SemPost(outQueued); // (to set its timer)
+  else *heldPV = 0, pvDepth = depth, pvTime = now; // (a line still held back is superseded)
+  Release(heldLock);
+}
+
+void PrintResult(int stm, int score)
+{
+  if(score == 0) printf("1/2-1/2\n");
+  if(score > 0 && stm == WHITE || score < 0 && stm == BLACK) printf("1-0\n");
+  else printf("0-1\n");
 }
 
 int engineSide=NONE;         // side played by engine
@@ -1776,7 +2527,7 @@ DoCommand (int searching)
   while(1) { // usually we break out of this loop after treating one command
 
     ReadLine();                   // read one line into inBuf (or retrieve backlogged)
-printf("# command: %s\n", inBuf);
+    if(echoCommands) printf("# command: %s", inBuf);
     if(!*inBuf) exit(0);          // EOF, terminate
     sscanf(inBuf, "%s", command); // extract the first word
     *inBuf = 0;                   // and already mark the buffer as empty
@@ -1794,6 +2545,14 @@ printf("# command: %s\n", inBuf);
     if(!strcmp(command, "option")) { // setting of engine-define option; find out which
       if(sscanf(inBuf+7, "Resign=%d",   &resign)         == 1) return 0;
       if(sscanf(inBuf+7, "Contempt=%d", &contemptFactor) == 1) return 0;
+      if(sscanf(inBuf+7, "NUMA interleave=%d", &numaInterleave) == 1) return 0;
+      if(sscanf(inBuf+7, "Thinking interval=%d", &pvInterval) == 1) return 0;
+      if(sscanf(inBuf+7, "Echo commands=%d", &echoCommands) == 1) return 0;
+      if(!strncmp(inBuf+7, "Shared hash=", 12)) {
+        char name[64] = ""; sscanf(inBuf+19, "%63s", name);
+        if(DropperShareHash(name)) printf("tellusererror Cannot map shared hash table %s\n", name);
+        return 0;
+      }
       return 1;
     }
 
@@ -1820,20 +2579,36 @@ printf("# command: %s\n", inBuf);
 				"5x5+5_shogi,6x6+6_shogi,7x7+6_shogi,11x17+16_chu\"\n");
       printf("feature option=\"Resign -check 0\"\n");           // example of an engine-defined option
       printf("feature option=\"Contempt -spin 0 -200 200\"\n"); // and another one
+      printf("feature option=\"NUMA interleave -check 0\"\n");
+      printf("feature option=\"Shared hash -string \"\n");
+      printf("feature option=\"Thinking interval -spin 100 0 5000\"\n");
+      printf("feature option=\"Echo commands -check 0\"\n");
       printf("feature done=1\n");
       return 1;
     }
     if(!strcmp(command, "sd"))      { sscanf(inBuf+2, "%d", &maxDepth);    return 1; }
     if(!strcmp(command, "st"))      { sscanf(inBuf+2, "%d", &timePerMove); return 1; }
-    if(!strcmp(command, "memory"))  { if(SetMemorySize(atoi(inBuf+7))) printf("tellusererror Not enough memory\n"), exit(-1); return 1; }
+    if(!strcmp(command, "memory"))  { if(DropperMemory(atoi(inBuf+7))) printf("tellusererror Not enough memory\n"), exit(-1); return 1; }
     if(!strcmp(command, "ping"))    { printf("pong%s", inBuf+4); return 1; }
 //  if(!strcmp(command, ""))        { sscanf(inBuf, " %d", &); return 1; }
     if(!strcmp(command, "new"))     { engineSide = BLACK; stm = WHITE; maxDepth = MAXPLY-2; randomize = OFF; moveNr = 0; ranKey = GetTickCount() | 0x1001; return 1; }
-    if(!strcmp(command, "variant")) { GameInit(inBuf + 8); Setup(startPos); return 1; }
-    if(!strcmp(command, "setboard")){ engineSide = NONE;  stm = Setup(inBuf+9); return 1; }
-    if(!strcmp(command, "undo"))    { TakeBack(1); return 1; }
-    if(!strcmp(command, "remove"))  { TakeBack(2); return 1; }
+    if(!strcmp(command, "variant")) { DropperVariant(inBuf + 8); return 1; }
+    if(!strcmp(command, "setboard")){ engineSide = NONE;  DropperSetup(inBuf+9); return 1; }
+    if(!strcmp(command, "undo"))    { DropperUndo(1); return 1; }
+    if(!strcmp(command, "remove"))  { DropperUndo(2); return 1; }
     if(!strcmp(command, "go"))      { engineSide = stm;  return 1; }
+    if(!strcmp(command, "bench"))   { int d = 4; sscanf(inBuf+5, "%d", &d); Bench(d); return 1; }
+    if(!strcmp(command, "perft"))   { int d = 3; sscanf(inBuf+5, "%d", &d); PerftCommand(d); return 1; }
+    if(!strcmp(command, "review"))  { int d = 8, t = 0; sscanf(inBuf+6, "%d %d", &d, &t); ReviewCommand(d, t); return 1; }
+    if(!strcmp(command, "pack"))    { if(!PackCommand(inBuf+4, 0)) printf("Error (cannot write packed position): %s", inBuf); return 1; }
+    if(!strcmp(command, "unpack"))  { if(!PackCommand(inBuf+6, 1)) printf("Error (no such packed position): %s", inBuf); return 1; }
+    if(!strcmp(command, "trace"))   { if(TraceCommand(inBuf+5)) printf("# tracing into %s\n", traceFile); return 1; }
+    if(!strcmp(command, "cluster")) { printf("# %d workers\n", DropperCluster(inBuf+7)); return 1; }
+    if(!strcmp(command, "search"))  { // job from the coordinator of a distributed search
+      char move[20]; int d, a, b;
+      if(sscanf(inBuf+6, "%19s %d %d %d", move, &d, &a, &b) == 4) SearchRootMove(move, d, a, b);
+      return 1;
+    }
     if(!strcmp(command, "hint"))    { if(ponderMove != INVALID) printf("Hint: %s\n", MoveToText(ponderMove)); return 1; }
     if(!strcmp(command, "book"))    {  return 1; }
     // completely ignored commands:
@@ -1844,14 +2619,13 @@ printf("# command: %s\n", inBuf);
     if(!strcmp(command, "accepted")){ return 1; }
     if(!strcmp(command, "rejected")){ return 1; }
     if(!strcmp(command, "?"))       { return 1; } // 'move now'
+    if(!strcmp(command, "stop"))    { return 1; } // coordinator calling back a worker that already finished
     if(!strcmp(command, "p"))       { Debug(); return 1; }
 
     if(!strcmp(command, "b"))       {  PrintDBoard("board:", board, "   ", 11); return 1; }
     if(!strcmp(command, ""))  {  return 1; }
     if(!strcmp(command, "usermove")){
-      int move = ParseMove(stm, inBuf+9);
-      if(move == INVALID) printf("Illegal move\n");
-      else if(!RootMakeMove(move)) printf("Illegal move\n");
+      if(!DropperMove(inBuf+9)) printf("Illegal move: %s", inBuf+9);
       else {
         ponderMove = INVALID;
       }
@@ -1862,31 +2636,38 @@ printf("# command: %s\n", inBuf);
   return 0;
 }
 
+#ifndef NOMAIN
 int
-main ()
+main (int argc, char **argv)
 {
-  int score, i;
-
-  EngineInit(); SetMemorySize(1);  // reserve minimal hash to prevent crash if GUI sends no 'memory' command
-  GameInit("zh"); Setup(startPos); // to facilitate debugging from command line
+  int score;
+
+  xboard = 1;
+  if(DropperInit(argc > 3 ? atoi(argv[3]) : 1)) printf("tellusererror Not enough memory\n"), exit(1); // reserve minimal hash to prevent crash if GUI sends no 'memory' command
+  if(StartOutput()) printf("tellusererror Cannot start output thread\n"), exit(1);
+#ifndef WIN32
+  if(argc > 2 && !strcmp(argv[1], "worker") && ServeWorker(argv[2])) { // dropper worker [IP:]PORT [MB]
+    printf("cannot accept a coordinator on port %s\n", argv[2]); exit(1);
+  }
+#endif
 
   while(1) { // infinite loop
 
     fflush(stdout);                 // make sure everything is printed before we do something that might take time
 
     if(stm == engineSide) {         // if it is the engine's turn to move, set it thinking, and let it move
-{int i;for(i=0; i<=hashMask+3; i++) /*if(hashTable[i].score != hashTable[i].lim)*/ hashTable[i].lock = 0;}
-      nodeCount = forceMove = undoInfo.move = abortFlag = 0; ReadClock(1);
-      for(i=0;i<1<<16;i++) history[i] = 0; //>>= 1;
-      for(i=0;i<1<<17;i++) mateKillers[i] = 0;
-      score = Search(stm^COLOR, -INF, INF, &undoInfo, maxDepth, 0, maxDepth);
+      DropperSearch *s = DropperGo(maxDepth, -1, PrintPV, NULL);
+      const char *move;
 
-      if(!undoInfo.move) {             // no move, game apparently ended
+      if(!s) printf("tellusererror Cannot start search thread\n"), exit(1);
+      move = DropperWait(s, &score);
+      FlushOutput();                   // all thinking output must precede the move
+      if(!move) {                      // no move, game apparently ended
         engineSide = NONE;             // so stop playing
         PrintResult(stm, score);
       } else {
-        RootMakeMove(undoInfo.move);   // perform chosen move (stores it in lastGameMove and changes stm)
-        printf("move %s\n", MoveToText(undoInfo.move)); // and output it
+        DropperMove(move);             // perform chosen move (changes stm)
+        printf("move %s\n", move);     // and output it
       }
     }
 
@@ -1910,3 +2691,4 @@ main ()
   }
   return 0;
 }
+#endif
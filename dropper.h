@@ -0,0 +1,72 @@
+/********************************************************************************************/
+/* Library interface of the engine, for embedding it in another program instead of talking  */
+/* xboard to it over a pipe. Build dropper.c with NOMAIN defined (see make.bat), and link   */
+/* with -lm -pthread. The engine state is global, so there is one game (and at most one     */
+/* running search) per process. Moves are in xboard notation (e2e4, e7e8q, P@f7, c7c8+).    */
+/********************************************************************************************/
+
+#ifndef DROPPER_H
+#define DROPPER_H
+
+#include <stdio.h>
+
+// called from the search thread for every new root PV; score as in xboard thinking output
+// (centipawns, or 100000+N for mate in N plies), pv as space-separated moves
+typedef void DropperInfo (void *closure, int depth, int score, int msec, int nodes, const char *pv);
+
+typedef struct DropperSearch DropperSearch;
+
+int  DropperInit (int hashMB);                // once, before anything else; returns 0 on success (else unusable)
+int  DropperMemory (int hashMB);              // resize the hash table (smaller if that size cannot be had);
+                                              // returns 0 on success, else there is no table (as after failed init)
+int  DropperShareHash (const char *name);     // map the table from named shared memory, so that processes on one
+                                              // host share it ("" = private); 0 on success
+void DropperVariant (const char *name);       // start a game of a variant (crazyhouse, shogi, ...)
+void DropperSetup (const char *fen);          // start a game from this position
+int  DropperMove (const char *move);          // play a move; returns 0 if it is not legal
+void DropperUndo (int n);                     // take back n moves
+int  DropperGoto (int ply);                   // take back or redo moves (of the game as it was before taking back)
+                                              // until ply moves are played; returns the ply reached. Costs one
+                                              // (cheap) unmake or make per ply of distance, not a constant: the
+                                              // repetition table has to follow every ply in between
+int  DropperCluster (const char *addresses); // search on workers ('dropper worker [IP:]PORT [MB]', which listen on
+                                              // 127.0.0.1 unless given an IP) at host:port addresses;
+                                              // returns how many are connected (none = search locally)
+
+// packed positions: a fixed-size binary record (per variant) with board, hands, side to move, castling and e.p.
+// rights, which loads without parsing FEN. Files of them start with a header naming the variant.
+typedef struct DropperPackFile DropperPackFile;
+
+int  DropperPackSize (void);                  // bytes per record in the current variant
+int  DropperPack (unsigned char *rec);        // store the game position in rec; returns the record size
+int  DropperUnpack (const unsigned char *rec); // start a game from a record; returns 0 if it is invalid
+DropperPackFile *DropperPackOpen (const char *name, int *count); // map a file of records read-only and switch to
+                                              // its variant; count receives the number of records (NULL = error)
+const unsigned char *DropperPackRecord (DropperPackFile *f, int n); // record n of the file, NULL if out of range
+void DropperPackClose (DropperPackFile *f);
+FILE *DropperPackCreate (const char *name);   // open a file of records of the current variant for appending
+int  DropperPackAppend (FILE *f);             // append the game position; 0 on error (close with fclose)
+
+// review of the game up to the current position: each position is searched for at most depth plies and msec
+// milliseconds (0 = no limit), last one first, in as many processes as there are cores (one on Windows);
+// DropperStop(NULL) from another thread stops it, leaving the positions it did not get to with nodes = 0
+typedef struct {
+  int score;                                  // of the position, for the side to move (as DropperInfo scores)
+  int played;                                 // of the game move made in it, for the same side (0 after the last)
+  char best[20];                              // best move in the position ("" = none)
+  int nodes;                                  // searched for it (0 = not reviewed)
+} DropperPly;
+
+int  DropperReview (int depth, int msec, DropperPly *plies); // fills plies[0..ply]; returns the number of positions
+
+// search the game position in a separate thread, for at most depth plies and msec milliseconds
+// (0 = no limit, -1 = as the xboard time-control commands say); the handle is valid until DropperWait.
+// Until DropperWait returns, the search owns the game: calls that read or change it (or the hash table) do
+// nothing and return failure (0, NULL, or for DropperMemory and DropperShareHash 1); only DropperPoll,
+// DropperStop, DropperWait and the packed-file calls that do not touch the game can be used
+DropperSearch *DropperGo (int depth, int msec, DropperInfo *info, void *closure);
+int  DropperPoll (DropperSearch *s);          // nonzero once the search has finished
+void DropperStop (DropperSearch *s);          // make the search finish as soon as possible
+const char *DropperWait (DropperSearch *s, int *score); // join it; best move (and its PV score), or NULL if none
+
+#endif
@@ -2,6 +2,13 @@ del *.o
 
 gcc -c dropper.c 
 	   
-gcc -o dropper.exe dropper.o 
+gcc -o dropper.exe dropper.o -lm
 
-del *.o
\ No newline at end of file
+gcc -O2 -o microbench.exe microbench.c -lm
+
+gcc -O2 -o tracetool.exe tracetool.c -lm
+
+gcc -O2 -DNOMAIN -c dropper.c -o libdropper.o
+ar rcs libdropper.a libdropper.o
+
+del *.o
@@ -0,0 +1,271 @@
+/********************************************************************************************/
+/* Micro-benchmarks for the hot primitives of the engine, each timed in isolation over the  */
+/* bench positions. Reports ns/call as mean and standard deviation over a number of samples,*/
+/* and, where the hardware counters can be read, cycles, instructions and misses per call.  */
+/* Usage: microbench [hash size in MB]                                                      */
+/********************************************************************************************/
+
+#define NOMAIN
+#include "dropper.c"
+#include <math.h>
+
+// the bench positions are crazyhouse, so time the primitives of the ZH instance the search uses
+#define MoveGen    MoveGenZH
+#define AllDrops   AllDropsZH
+#define CheckDrops CheckDropsZH
+#define MakeMove   MakeMoveZH
+#define UnMake     UnMakeZH
+#define Evaluate   EvaluateZH
+#define CheckTest  CheckTestZH
+#define Legal      LegalZH
+
+#define SAMPLES 15  /* independent timings per primitive, for the variance */
+#define REPS   100  /* repetitions per position within one timing           */
+#define BARRIER() __asm__ __volatile__("" ::: "memory") /* keeps gcc from hoisting pure calls out of the loop */
+
+#ifdef WIN32
+double
+Nanos ()
+{
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c); QueryPerformanceFrequency(&f);
+  return 1e9*c.QuadPart/f.QuadPart;
+}
+#else
+#include <time.h>
+double
+Nanos ()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return 1e9*t.tv_sec + t.tv_nsec;
+}
+#endif
+
+typedef struct { // time and counter totals of a primitive over one timing
+  double ns, t0;
+  long long count[NR_COUNTERS], c0[NR_COUNTERS];
+} Sample;
+
+void
+Start (Sample *s)
+{
+  CountersRead(s->c0); s->t0 = Nanos(); // counters outside the clock, so that reading them is not timed
+}
+
+void
+Stop (Sample *s)
+{
+  long long c[NR_COUNTERS]; int i;
+  s->ns += Nanos() - s->t0; CountersRead(c);
+  for(i=0; i<NR_COUNTERS; i++) s->count[i] += c[i] - s->c0[i];
+}
+
+StackFrame root;             // frame describing the loaded position, as Search would set it up
+MoveStack gen;
+int moves[2*MAXMOVES], nrMoves, loaded;
+Key childKeys[2*MAXMOVES];
+
+void
+LoadPosition (int n)
+{ // set up bench position n, and collect its board moves and drops
+  int i;
+  GameInit(variants[0].name); stm = Setup(benchPositions[loaded = n]); moveNr = ply = 0;
+  root.hashKey = undoInfo.newKey; root.pstEval = -undoInfo.newEval;
+  root.rights = undoInfo.rights; root.checker = CK_NONE;
+  gen.epSqr = 255;
+  moveSP = 48; MoveGen(stm, &gen, root.rights); AllDrops(stm);
+  for(nrMoves=0, i=gen.firstMove; i<moveSP; i++) {
+    StackFrame f = root;
+    moves[nrMoves] = moveStack[i];
+    if(MakeMove(&f, moves[nrMoves])) childKeys[nrMoves++] = f.newKey, UnMake(&f);
+  }
+  moveSP = 0;
+}
+
+int
+TimeMoveGen (Sample *s)
+{
+  int r; Start(s);
+  for(r=0; r<REPS; r++) moveSP = 48, MoveGen(stm, &gen, root.rights);
+  Stop(s); moveSP = 0;
+  return REPS;
+}
+
+int
+TimeAllDrops (Sample *s)
+{
+  int r; Start(s);
+  for(r=0; r<REPS; r++) moveSP = 0, AllDrops(stm);
+  Stop(s); moveSP = 0;
+  return REPS;
+}
+
+int
+TimeCheckDrops (Sample *s)
+{
+  int r, xking = location[(stm^COLOR)+31]; Start(s);
+  for(r=0; r<REPS; r++) moveSP = 0, CheckDrops(stm, xking);
+  Stop(s); moveSP = 0;
+  return REPS;
+}
+
+int
+TimeMakeUnMake (Sample *s)
+{
+  int r, i; StackFrame f = root; Start(s);
+  for(r=0; r<REPS; r++) for(i=0; i<nrMoves; i++) if(MakeMove(&f, moves[i])) UnMake(&f);
+  Stop(s);
+  return REPS*nrMoves;
+}
+
+int
+TimeEvaluate (Sample *s)
+{
+  int r, sum = 0; Start(s);
+  for(r=0; r<REPS; r++) { sum += Evaluate(stm, root.rights); BARRIER(); }
+  Stop(s);
+  return REPS + (sum == INF); // use the sum, so the calls cannot be optimized away entirely
+}
+
+int
+TimeCheckTest (Sample *s)
+{ // test for check in the position after every move
+  int r, i; StackFrame f = root, g;
+  for(i=0; i<nrMoves; i++) if(MakeMove(&f, moves[i])) {
+    Start(s);
+    for(r=0; r<REPS; r++) { CheckTest(stm^COLOR, &f, &g); BARRIER(); }
+    Stop(s);
+    UnMake(&f);
+  }
+  return REPS*nrMoves;
+}
+
+int
+TimeLegal (Sample *s)
+{ // test every board move for exposing our King, as Search does for the hash move and killers
+  int r, i, n = 0, sum = 0;
+  for(i=0; i<nrMoves; i++) if(!(board[moves[i] >> 8 & 255] & 128)) { // (drops are legal without looking)
+    Start(s);
+    for(r=0; r<REPS; r++) { sum += Legal(stm, moves[i]); BARRIER(); }
+    Stop(s); n++;
+  }
+  return REPS*n + (sum < 0);
+}
+
+int
+TimeHashProbe (Sample *s)
+{ // probe for the positions after every move, half of which are present in the table
+  int r, i, hit, hits = 0; HashEntry copy;
+  for(i=0; i<nrMoves; i+=2) ProbeHash(childKeys[i], stm^COLOR, root.rights, 255, &hit, &copy)->lock = childKeys[i] >> 32;
+  Start(s);
+  for(r=0; r<REPS; r++) for(i=0; i<nrMoves; i++) { ProbeHash(childKeys[i], stm^COLOR, root.rights, 255, &hit, &copy); hits += hit; BARRIER(); }
+  Stop(s);
+  return REPS*nrMoves + (hits < 0);
+}
+
+int
+TimeHashStore (Sample *s)
+{ // probe and store the positions after every move, with the replacement Search does on a miss
+  int r, i, hit; HashEntry *entry, *entry2, copy, data = { 0 };
+  Start(s);
+  for(r=0; r<REPS; r++) for(i=0; i<nrMoves; i++) {
+    entry = ProbeHash(childKeys[i], stm^COLOR, root.rights, 255, &hit, &copy);
+    if(!hit) {
+      entry2 = entry - 3; entry2 += (entry2[0].depth > entry2[1].depth);
+      entry -= (entry[0].depth > entry[-1].depth);
+      if(entry->depth > entry2->depth) entry = entry2;
+    }
+    data.move = moves[i]; data.score = data.lim = r; data.depth = r & 7;
+    data.flags = H_LOWER; data.checker = CK_NONE;
+    StoreHash(entry, &data, childKeys[i] >> 32);
+    BARRIER();
+  }
+  Stop(s);
+  return REPS*nrMoves;
+}
+
+int
+TimeSort (Sample *s)
+{ // history sort of the non-captures, as Search does when it reaches them
+  int r, i, n = 0, list[2*MAXMOVES];
+  for(i=0; i<nrMoves; i++) if(!(moves[i] & 0xFF000000)) list[n++] = moves[i]; // no MVV/LVA key: not a capture
+  Start(s);
+  for(r=0; r<REPS; r++) { int sorted[2*MAXMOVES]; memcpy(sorted, list, n*sizeof(int)); qsort(sorted, n, sizeof(int), &HisComp); BARRIER(); }
+  Stop(s);
+  return REPS;
+}
+
+int
+TimeSetup (Sample *s)
+{ // load the position from its FEN, for comparison with unpacking it
+  int r, n = 0; char *fen = benchPositions[loaded]; Start(s);
+  for(r=0; r<REPS; r++) { n += Setup(fen); BARRIER(); }
+  Stop(s);
+  return REPS + (n < 0);
+}
+
+int
+TimeUnpack (Sample *s)
+{ // load the position from a packed record
+  int r, n = 0; unsigned char rec[256]; PackPosition(rec); Start(s);
+  for(r=0; r<REPS; r++) { n += UnpackPosition(rec); BARRIER(); }
+  Stop(s);
+  return REPS + (n < 0);
+}
+
+struct {
+  char *name;
+  int (*func)(Sample *s);
+} primitives[] = {
+  { "MoveGen",        TimeMoveGen },
+  { "AllDrops",       TimeAllDrops },
+  { "CheckDrops",     TimeCheckDrops },
+  { "MakeMove+UnMake",TimeMakeUnMake },
+  { "Evaluate",       TimeEvaluate },
+  { "CheckTest",      TimeCheckTest },
+  { "Legal",          TimeLegal },
+  { "hash probe",     TimeHashProbe },
+  { "hash store",     TimeHashStore },
+  { "history sort",   TimeSort },
+  { "Setup (FEN)",    TimeSetup },
+  { "unpack",         TimeUnpack },
+  { NULL, NULL }
+};
+
+int
+main (int argc, char **argv)
+{
+  int p, s, i, n, counters; long long total[20][NR_COUNTERS], calls[20], have[NR_COUNTERS];
+  EngineInit(); SetMemorySize(argc > 1 ? atoi(argv[1]) : 64);
+  for(i=0; i<1<<16; i++) history[i] = (i*2654435761u >> 20) & 0x3FF; // something to sort on
+  counters = CountersOpen(); CountersRead(have);
+  printf("%-16s %9s %9s %9s %10s\n", "primitive", "ns/call", "stddev", "min", "calls");
+  for(p=0; primitives[p].name; p++) {
+    double sum = 0, sum2 = 0, min = 1e30, mean, var;
+    memset(total[p], 0, sizeof(total[p])); calls[p] = 0;
+    for(s=0; s<SAMPLES; s++) {
+      Sample t; double ns;
+      memset(&t, 0, sizeof(t));
+      for(i=n=0; benchPositions[i]; i++) LoadPosition(i), n += primitives[p].func(&t);
+      ns = t.ns/n; sum += ns; sum2 += ns*ns;
+      if(ns < min) min = ns;
+      for(i=0; i<NR_COUNTERS; i++) total[p][i] += t.count[i];
+      calls[p] += n;
+    }
+    mean = sum/SAMPLES; var = sum2/SAMPLES - mean*mean;
+    printf("%-16s %9.2f %9.2f %9.2f %10d\n", primitives[p].name, mean, sqrt(var > 0 ? var : 0), min, n);
+  }
+
+  // the same primitives per call in hardware events: many misses point at memory, many branch misses at control flow
+  if(!counters) { printf("\nhardware counters not available\n"); return 0; }
+  printf("\n%-16s", "per call");
+  for(i=0; i<NR_COUNTERS; i++) if(have[i] >= 0) printf(" %9s", counterName[i]);
+  printf(" %9s\n", "IPC");
+  for(p=0; primitives[p].name; p++) {
+    printf("%-16s", primitives[p].name);
+    for(i=0; i<NR_COUNTERS; i++) if(have[i] >= 0) printf(" %9.2f", (double) total[p][i]/calls[p]);
+    printf(" %9.2f\n", (double) total[p][1]/(total[p][0] + 1));
+  }
+  return 0;
+}
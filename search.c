@@ -0,0 +1,946 @@
+/********************************************************************************************/
+/* Search, move generation and evaluation. This file is included twice by dropper.c: once   */
+/* for all variants, reading board size, hand size and rules from the variables GameInit    */
+/* sets, and once for crazyhouse, with those replaced by constants and the functions renamed*/
+/* with a ZH suffix. The variant command picks the instance RootSearch dispatches to.       */
+/********************************************************************************************/
+
+int
+Evaluate (int stm, int rights)
+{
+    static int rays[] = {1, -1, 22, -22, 23, -23, 21, -21 };
+    int k, f, s, score = 0, w, b;
+    k = location[WHITE+31]; s = (k >= 1*22)*6 + 1;
+    score += ((board[k+22] == WHITE) + ((board[k+22+1] == WHITE) + (board[k+22-1] == WHITE) - 2)*s)*2;
+    score += (!board[k+1] + !board[k-1])*(board[k+22] != BLACK)*5;
+    score -= (2*(board[k+22] == BLACK) + (board[k+44] == BLACK) + (board[k+44+1] == BLACK) + (board[k+44-1] == BLACK))*5;
+    for(f=w=0; f<8; f++) { // mark squares from which 
+	int v = rays[f], x = k + v;
+	if(!board[x]) while(!board[x+=v]) w++;
+    }
+    if(k >= killZone) score -= 100;
+    k = location[BLACK+31]; s = (k < boardEnd - 1*22)*6 + 1;
+    score -= ((board[k-22] == BLACK) + ((board[k-22+1] == BLACK) + (board[k-22-1] == BLACK) - 2)*s)*2;
+    score -= (!board[k+1] + !board[k-1])*(board[k-22] != WHITE)*5;
+    score += (2*(board[k-22] == WHITE) + (board[k-44] == WHITE) + (board[k-44+1] == WHITE) + (board[k-44-1] == WHITE))*5;
+    for(f=b=0; f<8; f++) { // mark squares from which 
+	int v = rays[f], x = k + v;
+	if(!board[x]) while(!board[x+=v]) b++;
+    }
+    if(k < boardEnd - killZone) score += 100;
+    score *= 5;
+    score -= ((board[   0] == WHITE+3 && board[0*22+1] && board[1*22]) + (board[     7] == WHITE+3 && board[     6] && board[1*22+7]))*25;
+    score += ((board[7*22] == BLACK+3 && board[7*22+1] && board[6*22]) + (board[7*22+7] == BLACK+3 && board[7*22+6] && board[6*22+7]))*25;
+    score -= ((board[     2] == WHITE+2 && board[1*22+1] && board[1*22+3]) + (board[     5] == WHITE+2 && board[1*22+6] && board[1*22+4]))*15;
+    score += ((board[7*22+2] == BLACK+2 && board[6*22+1] && board[6*22+3]) + (board[7*22+5] == BLACK+2 && board[6*22+6] && board[6*22+4]))*15;
+    score += rightsScore[rights];
+    return stm == WHITE ? score + 15*b - 9*w : -score - 15*w + 9*b;
+}
+
+int
+SquareAttacked (int stm, int sqr)
+{   // test whether side stm attacks sqr; the occupant of sqr itself is ignored
+    int i, v, x, p;
+    for(i=0; (v = contactVec[i]); i++) { // leaps, and first steps of slides
+	p = board[sqr - v];
+	if((p & (COLOR|128)) == stm && captCode[v] & pieceCode[p] & C_CONTACT) return 1;
+    }
+    for(i=0; (v = slideVec[i]); i++) { // slides from further away
+	x = sqr;
+	while(board[x -= v] == 0) {} // scan ray
+	p = board[x];
+	if((p & (COLOR|128)) == stm && captCode[sqr - x] & pieceCode[p] & C_DISTANT) return 1;
+    }
+    return 0;
+}
+
+int
+Legal (int stm, int move)
+{   // test whether a pseudo-legal move leaves our King safe; for moves that did not come from MoveGen (hash move, killers)
+    int from = move >> 8 & 255, to = move & 255, king = location[stm+31], xstm = stm ^ COLOR, piece = board[from], r;
+    if(piece & 128) return 1; // drops never expose the King (and do not come here when in check)
+    if(from == king) { // King steps are tested by MakeMove, but castling is not
+	if(to < specials) return 1;
+	board[from] = 0;
+	r = !SquareAttacked(xstm, king) && !SquareAttacked(xstm, toDecode[to]) && !SquareAttacked(xstm, dropType[to]);
+	board[from] = piece;
+    } else { // make the move on the board, and see if anything now hits our King
+	int capt = to = toDecode[to], victim = board[to], eps;
+	if((move & 255) >= specials && sqr2file[move & 255] > 11) capt = toDecode[(move & 255) - 11]; // e.p.
+	eps = board[capt];
+	board[from] = board[capt] = 0; board[to] = piece;
+	r = !SquareAttacked(xstm, king);
+	board[to] = victim; board[capt] = eps; board[from] = piece;
+    }
+    return r;
+}
+
+int
+PseudoLegal (int stm, int move)
+{   // used for testing killers, so we can assume the move must be pseudo-legal for the stm in some position
+    int match, from = move >> 8 & 0xFF, to = move & 255;
+    signed char piece = board[from], mover = move >> 16 & 0xFF;
+    to = toDecode[to]; // could be double-push or castling, though
+    if(board[to]) return 0;
+    if(piece < 0) { // drop
+	if(piece == -1) return 0; // type not in hand
+	piece = dropType[from] - 1;
+	if(!(piece & stm)) return 0; // piece has wrong color
+        if((piece & ~COLOR) == 0 && pawnCount[sqr2file[to]] & maxBulk[stm]) return 0; // Pawn drop would over-crowd file
+	return (board[to] == 0); // otherwise drop is legal on empty square (assumes drop location always legal for piece type)
+    }
+    if(!(piece & stm)) return 0; // piece has wrong color
+    if(piece == stm) { /// Pawn
+	if(stm == WHITE) return board[from+22] == 0 && (to - from == 22 || zoneTab[from] & 0x80 && to - from == 44 && board[to] == 0) && Legal(stm, move);
+	return board[from-22] == 0 && (to - from == -22 || zoneTab[from] & 0x80 && to - from == -44 && board[to] == 0) && Legal(stm, move);
+    }
+    match = pieceCode[piece] & captCode[to - from];
+    if(!match) return 0; // not aligned
+    if(match & C_DISTANT) { // distant alignment
+	int step = deltaVec[to - from];
+	while(board[to -= step] == 0) {}   // ray scan towards mover
+	if(from != to) return 0;           // blocked before it reaches mover
+    } else if((move & 255) > specials) return 0; // must be castling, as Pawns were already taken care of. Forbid for now.
+    return Legal(stm, move); // leaper alignment guarantees hit; but it might be pinned
+}
+
+int
+MoveGen (int stm, MoveStack *m, int castle)
+{   // generate board moves that do not expose our King (MakeMove vets King steps), return 1 if King capture found amongst those
+    int r, f, i, v, c = ++attackKey, side = SIDE(stm), king = location[stm+31], xstm = stm ^ COLOR;
+    m->firstMove = m->nonCapts =  m->late = moveSP; m->stage = 0;
+    for(i=0; (v = slideVec[i]); i++) { // mark our pieces pinned to our King, with the ray they must stay on
+	int x = king, y;
+	while(board[x += v] == 0) {}
+	if((board[x] & (COLOR|128)) != stm) continue; // nothing of ours to pin
+	y = x; while(board[y += v] == 0) {}
+	if((board[y] & (COLOR|128)) == xstm && captCode[king - y] & pieceCode[board[y]] & C_DISTANT) pinKey[x] = c, pinStep[x] = v;
+    }
+    for(i=0; i<pieceCount[side]; i++) { // run through the list of our pieces
+	int from = pieceList[side][i], piece = board[from], pin = (pinKey[from] == c ? pinStep[from] : 0);
+	int step, dir = 2*firstDir[piece-WHITE]; // steps data comes in pairs
+	while((step = steps[dir++])){ // next direction
+	    int range = steps[dir++], to = from, victim, inZone = zoneTab[from], d = c - (range == 11);
+	    int ok = !pin || step == pin || step == -pin; // pinned piece can only move along the pin ray (but still attacks elsewhere)
+	    do {
+		int move, promote, slot;
+		victim = board[to += step];
+		attacks[to] = d; // keep track of attacked squares (even with own piece)
+		if(victim & 128 || (victim & stm) && (victim & ~COLOR) == 31) break; // off board, or own King (which cannot be captured)
+		// Allow capturing own pieces (except King)
+		if(range & 2) { // divergent move: must be FIDE Pawn
+		    if(to == m->epSqr) { // reaches e.p. square: must be through diagonal move, and e.p. square is always empty
+			int capt = to + (stm == WHITE ? -22 : 22), xpawn = board[capt]; // try it, as it removes two pieces from their ray
+			board[from] = board[capt] = 0; board[to] = piece;
+			ok = !SquareAttacked(xstm, king);
+			board[from] = piece; board[capt] = xpawn; board[to] = 0;
+			if(ok) moveStack[--m->firstMove] = to + 4*22+11 + 44*(stm == BLACK) | from << 8 | vVal[0] << 24;
+			break;
+		    }
+		    if(!victim == (range & 1)) break; // wrong type (lsb set = capture only, cleared = move only)
+		    if(range > 7) { // can do double push
+			if(ok && inZone & Z_DOUBLE && board[to+step] == 0) {   // started on Pawn rank, and square in front of it is empty
+			    moveStack[moveSP++] = from << 8 | to + step + 22*5; // generate now, as special move
+			}
+			range -= 8; // make sure it is not done again
+		    }
+		}
+		if((victim & ~COLOR) == 31) return 1; // captures King; abort!
+		move = piece << 16;   // store piece in move
+		promote = (inZone | zoneTab[to]) & promoCode[piece-WHITE];
+		if(ok && (promote & ((Z_2ND | Z_MUST ) & ~COLOR)) == 0) { // not in place where deferral forbidden
+		    int slot;
+		    if(victim) { // capture
+			slot = --m->firstMove;
+			if(victim & stm) move += 1 << 24; // self-capture: behind all real captures
+			else move += vVal[victim-WHITE] - aVal[piece-WHITE] << 24; // MVV/LVA sort code
+		    } else { // non-capture
+			slot = moveSP++;
+		    }
+		    moveStack[slot] = move | from << 8 | to;
+		}
+		if(ok && promote & stm) { // promotion is (also?) possible
+		    moveStack[--m->firstMove] = (move | from << 8 | to + 11) + (vVal[victim-WHITE] + 20 << 24); // put it amongst captures
+		    if(!perpLoses) { // only for FIDE Pawns
+			moveStack[--m->firstMove] = move | from << 8 | to - 11 + (stm >> 6)*44; // turn previously-generated deferral into under-promotion
+			// other under-promotions could go here (Capahouse?)
+		    }
+		}
+
+
+		if((range -= 8) <= 0) break; // range exhausted
+	    } while(!victim);
+
+	}
+    }
+
+    r = king; m->castlings = moveSP; f = 0;
+    if(!(stm >> 5 & castle)) { // K-side castling
+	f++;
+	if(board[r+1] == 0 && board[r+2] == 0) {
+	    f += 2; board[r] = 0; // King must not pass through or land in check (being in check is tested by caller)
+	    if(!SquareAttacked(xstm, r+1) && !SquareAttacked(xstm, r+2)) moveStack[moveSP++] = r << 8 | 8*22+10 + 22*(stm == BLACK);
+	    board[r] = stm + 31;
+	}
+    }
+    if(!(stm >> 3 & castle)) { // Q-side castling
+	f++;
+	if(board[r-1] == 0 && board[r-2] == 0 && board[r-3] == 0) {
+	    f += 2; board[r] = 0;
+	    if(!SquareAttacked(xstm, r-1) && !SquareAttacked(xstm, r-2)) moveStack[moveSP++] = r << 8 | 8*22+21 + 22*(stm == BLACK);
+	    board[r] = stm + 31;
+	}
+    }
+    m->cBonus = f;
+
+    r = location[stm+31^COLOR]; // enemy King
+#   define HOLE(X) (attacks[X] == c)*!board[X]
+    m->hole = HOLE(r+1) + HOLE(r-1) + HOLE(r+22) + HOLE(r+21) + HOLE(r+23) + HOLE(r-21) + HOLE(r-22) + HOLE(r-23);
+#   define SAFE(X) (attacks[X] == c)*!(board[X] & stm)
+    m->safety = SAFE(r+1) + SAFE(r-1) + SAFE(r+22) + SAFE(r+21) + SAFE(r+23) + SAFE(r-21) + SAFE(r-22) + SAFE(r-23);
+#   define ESC(X) (board[X] & stm || attacks[X] == c)
+    m->escape = 8 - (ESC(r+1) + ESC(r-1) + ESC(r+22) + ESC(r+21) + ESC(r+23) + ESC(r-21) + ESC(r-22) + ESC(r-23));
+    if(stm == WHITE) r = boardEnd - 1 - r;
+    m->safety += (r >= 1*22) + frontierPenalty*(r >= frontier) + killPenalty*(r >= killZone) - 5*(r >= impasse);
+    m->unsorted = m->firstMove; m->drops = moveSP; m->quiet = 500*MAXPLY;
+    return 0;
+}
+
+void
+CheckDrops (int stm, int king)
+{
+    int i, lowest = 0, bits = HAND(stm);
+    if(perpLoses) lowest = !!(pawnCount[sqr2file[king]] & maxBulk[stm]); // in Shogi no Pawn if file already crowded with those
+    else lowest = (stm == WHITE ? king < 2*22 : king >= 6*22);           // in zh no Pawn from back rank
+    bits &= -1 << lowest;
+    for(i=maxDrop; bits; i--) if(bits >> i & 1) { // piece type is in hand
+	int piece = stm + i, from = handSlot[piece^COLOR] << 8, n, *t = checkStart[piece-WHITE] + king;
+	bits ^= 1 << i;
+	for(n=t[0]; n<t[1]; n++) { // tabulated squares from where it would check
+	    int to = checkSqr[n];
+	    if(board[to]) n += checkSkip[n]; // occupied: rest of ray is blocked
+	    else moveStack[moveSP++] = to | from;
+	}
+    }
+}
+
+void
+EvasionDrops (int stm, StackFrame *f, int mask)
+{
+    int i, x = f->checker, v = f->checkDir, s = stm ^ COLOR, hand = HAND(stm);
+    while(board[x+=v] == 0) { // all squares on check ray
+	int last = maxDrop;
+	if((mask >>= 1) & 1) continue; // suppress 'futile interpositions'
+	i = zoneTab[x] & Z_LAST; // Pawn not on first & last rank (OK for zh)
+	if(perpLoses) { // but it is Shogi!
+	    if(!(zoneTab[x] & stm)) i = 0; // outside zone, so dropping is always allowed
+	    else if(perpLoses < TORI_NR) { // Shogi variant with Lance
+		i *= 2;                    // no Pawn, then also no Lance!
+		last += 1 - (zoneTab[x] & (Z_2ND & ~COLOR)) + (perpLoses & 4) >> 3; // on last 2 ranks trim off Knight (not in Wa)
+	    }
+	    if(pawnCount[sqr2file[x]] & maxBulk[stm]) i += !i; // no Pawn in pawn-crowded file
+	}
+	for(; i<=last && hand >> i; i++) if(hand >> i & 1) // all droppable types that are in hand
+	    moveStack[moveSP++] = handSlot[s + i] << 8 | x;
+    }
+}
+
+void
+AllDrops (int stm)
+{
+    int i, j, k, n, r, f, mask = lanceMask, bits = HAND(stm), crowded = 0;
+    unsigned char empty[22*11], fileEnd[11];
+    if(!bits) return;
+    for(f=n=0; f<nrFiles; f++) { // collect the empty squares once for all types, by file
+	for(r=0; r<boardEnd; r+=22) if(board[r+f] == 0) empty[n++] = r + f;
+	fileEnd[f] = n;
+	crowded |= !!(pawnCount[f] & maxBulk[stm]) << f; // files where no more Pawns can go
+    }
+    for(i=0; bits >> i; i++, mask >>= 1) if(bits >> i & 1) { // piece type is in hand
+	int piece = stm + i, from = handSlot[piece^COLOR] << 8, start = 0, end = boardEnd, skip = (i == 0)*crowded;
+	if(!(mask & 1) && !skip) { // can go on any empty square
+	    for(k=0; k<n; k++) moveStack[moveSP++] = from | empty[k];
+	    continue;
+	}
+	if(mask & 1) { // piece with drop limitation
+	    int badZone = (i == 6 ? 44 : 22); // 6 is the Knight in (Judkins) Shogi
+	    if(stm == BLACK || !perpLoses) start = badZone;
+	    if(stm == WHITE || !perpLoses) end  -= badZone;
+	}
+	for(f=j=0; f<nrFiles; j = fileEnd[f++]) {
+	    if(skip >> f & 1) continue;
+	    for(k=j; k<fileEnd[f]; k++)
+		if(empty[k] >= start && empty[k] < end) moveStack[moveSP++] = from | empty[k];
+	}
+    }
+}
+
+int
+DiscoTest (int stm, int fromSqr, int king, StackFrame *f)
+{
+    int vec = king - fromSqr;
+    int match = captCode[vec] & pinCodes;
+    if(match) { // from-square is aligned
+	int x = king, v = deltaVec[vec];
+	while(board[x-=v] == 0) {}   // scan ray
+	if(f->checker != x && !(board[x] & stm) && captCode[king-x] & pieceCode[board[x]]) { // discovered check
+	    if(f->checker != CK_NONE) f->checker = CK_DOUBLE;
+	    else f->checker = x, f->checkDir = v, f->checkDist = dist[x-king];
+	}
+    }
+}
+
+void
+CheckTest (int stm, StackFrame *ff, StackFrame *f)
+{
+    if(ff->mutation == -2) f->checker = CK_NONE, f->checkDist = 0; else { // null move never checks
+	int king = location[stm+31]; // own King
+	int vec = king - ff->toSqr;
+	int match = captCode[vec] & pieceCode[ff->toPiece];
+	f->checker = CK_NONE; f->checkDist = 0; // assume not in check
+	if(match & C_DISTANT) { // moving piece is aligned
+	    int x = ff->toSqr, v = deltaVec[vec];
+	    while(board[x+=v] == 0) {} // scan ray
+	    if(x == king) f->checker = ff->toSqr, f->checkDir = v, f->checkDist = dist[vec]; // ray is clear, distant check
+	} else if(match & C_CONTACT) f->checker = ff->toSqr, f->checkDir = 0; // contact check
+	if(ff->mutation != -1) { // board move (no drop)
+	    DiscoTest(stm, ff->fromSqr, king, f);
+	    if(board[ff->captSqr] == 0) DiscoTest(stm, ff->captSqr, king, f); // e.p. capture can discover check as well
+	}
+    }
+}
+
+void
+RootCheck (int stm, StackFrame *f)
+{   // find the checkers of the King of stm from scratch, for a position that was set up rather than reached by a move
+    int i, v, x, p, king = location[stm+31], xstm = stm ^ COLOR, n = 0;
+    f->checker = CK_NONE; f->checkDist = 0;
+    for(i=0; (v = contactVec[i]); i++) { // leaps, and first steps of slides
+	p = board[king - v];
+	if((p & (COLOR|128)) == xstm && captCode[v] & pieceCode[p] & C_CONTACT) f->checker = king - v, f->checkDir = 0, n++;
+    }
+    for(i=0; (v = slideVec[i]); i++) { // slides from further away
+	x = king;
+	while(board[x -= v] == 0) {} // scan ray
+	p = board[x];
+	if(x != king - v && (p & (COLOR|128)) == xstm && captCode[king - x] & pieceCode[p] & C_DISTANT)
+	    f->checker = x, f->checkDir = v, f->checkDist = dist[king - x], n++;
+    }
+    if(n > 1) f->checker = CK_DOUBLE;
+}
+
+int
+SafeIP (StackFrame *f)
+{   // figure out which squares are protected on the check ray
+    int result = 0, v = f->checkDir, x = f->checker, mask = 1;
+    while(board[x+=v] == 0) result |= (mask <<= 1)*(attackKey != attacks[x]);
+    return result & ~mask;
+}
+
+int
+NonEvade (StackFrame *f)
+{
+    if((f->fromPiece & ~COLOR) != 31) { // moves non-royal (or drops)
+	int d;
+	if(f->checker == CK_DOUBLE) return 1; // never helps against double check
+	if(f->toSqr == f->checker) return 0;  // captures only checker: OK
+	d = dist[f->checker - f->toSqr];
+	if(d && deltaVec[f->toSqr - f->checker] == f->checkDir && d < f->checkDist) return 0; // interposes: OK
+	if(f->fromPiece + board[f->checker] == COLOR && f->toSqr - f->fromSqr & 1) return (board[f->toSqr] != 0);
+	return 1;
+    }
+    // king move
+    return 0; // MakeMove tests if it steps out of check
+}
+
+int
+MakeMove (StackFrame *f, int move)
+{
+    int to, stm; Transfer *t;
+    f->fromSqr = move >> 8 & 255;
+    to = move & 255;
+    f->wholeMove = move;
+    f->toSqr = f->captSqr = toDecode[to];                               // real to-square for to-encoded special moves
+    f->fromPiece = board[f->fromSqr];                                   // occupant or (for drops) complemented holdings count
+    if(f->checker != CK_NONE && NonEvade(f)) return 0;                  // abort if move did not evade existing check
+    if((f->fromPiece & ~COLOR) == 31 && to < specials) {                // King step (castling was tested by MoveGen): abort if it steps into check
+	int safe;
+	board[f->fromSqr] = 0; safe = !SquareAttacked(COLOR - (f->fromPiece & COLOR), f->toSqr); board[f->fromSqr] = f->fromPiece;
+	if(!safe) return 0;
+    }
+    f->mutation = (f->fromPiece >> 7) | f->fromPiece;                   // occupant or (for drops) -1
+    f->toPiece = f->mutation + dropType[f->fromSqr] | promoInc[to];     // (possibly promoted) occupant or (for drops) piece to drop
+    f->victim = board[f->captSqr];					// for now this is the replacement victim
+    f->newEval = f->pstEval; f->newKey  = f->hashKey;			// start building new key and eval
+    f->epSqr = 255;
+    f->rookSqr = sqr2file[f->toSqr] + (pawnCount - board);              // normally (i.e. when not castling) use for pawnCount
+    f->rook = board[f->rookSqr];					// save and update Pawn occupancy
+    board[f->rookSqr] = f->rook + pawnBulk[f->toPiece] - pawnBulk[f->mutation] - pawnBulk[f->victim]; // assumes all on same file!
+//printf("f=%02x t=%02x fp=%02x tp=%02x sp=%02x mut=%02x ep=%02x\n", f->fromSqr, f->toSqr, f->fromPiece, f->toPiece, f->savePiece, f->mutation, f->epSqr);
+    if(to >= specials) { // treat special moves for Chess
+	if(sqr2file[to] > 11) {                                         // e.p. capture, shift capture square
+//printf("# e.p. %02x\n", to);
+	    f->captSqr = toDecode[to-11];				// use to-codes from double pushes, which happen to be what we need
+	    f->victim  = board[f->captSqr];
+	    f->savePiece = board[f->toSqr];
+	    board[f->captSqr] = 0;					// e.p. is only case with toSqr != captSqr where we have to clear captSqr
+	} else if(sqr2file[to] < 8) {					// double push
+	    int xpawn = f->toPiece ^ COLOR;				// enemy Pawn
+	    if(board[f->toSqr + 1] == xpawn ||				// if land next to one
+	       board[f->toSqr - 1] == xpawn ) {
+		f->epSqr = (f->fromSqr + f->toSqr) >> 1;		// set e.p. rights
+	    }
+	} else { // castling. at this point we are set up to 'promote' a King to Rook (so the check tests sees the Rook, and UnMake restores location[K])
+	    f->rookSqr = zoneTab[to];					// Rook from-square
+	    f->rook = board[f->rookSqr];                                // arrange Rook to be put back on UnMake (pawnCount is never modified in chess)
+	    board[f->rookSqr] = 0;					// and remove it
+	    f->newEval -= PST[f->rook][f->rookSqr];
+	    f->newKey  -= KEY(f->rook, f->rookSqr);
+	    f->captSqr = dropType[to];					// this tabulates to-square of the King
+	    f->savePiece = f->victim;					// now toSqr and captSqr are different, make sure the piece that was on toSqr goes back there in UnMake
+	    f->victim = board[f->captSqr];				// should be 0, but who knows?
+	    f->toPiece = f->rook;					// make sure Rook (or whatever was in corner) will be placed on toSqr
+	    board[f->captSqr] = f->mutation;				// place the King
+	    MOVE_PIECE(SIDE(f->rook), f->rookSqr, f->captSqr);		// for the piece list only the set of occupied squares matters
+	    f->newEval += PST[f->mutation][f->captSqr] + 50;		// add 50 cP castling bonus
+	    f->newKey  += KEY(f->mutation, f->captSqr);
+	    location[f->mutation] = f->captSqr;				// be sure King location stays known
+	}
+    }
+    board[f->fromSqr] = f->fromPiece - f->mutation;                     // 0 or (for drops) decremented count
+    board[f->toSqr]   = f->toPiece;
+    t = &transfer[SIDE(f->toPiece)][f->victim];                        // victim goes to hand: same color after self-capture, else flipped
+    board[t->slot]--; handBits |= t->bit;
+    f->newEval += promoGain[f->toPiece] - promoGain[f->mutation]                                        + t->val +
+		  PST[f->toPiece][f->toSqr] - PST[f->mutation][f->fromSqr] + PST[f->victim][f->captSqr];
+    f->newKey  += KEY(f->toPiece, f->toSqr) - KEY(f->mutation, f->fromSqr) - KEY(f->victim, f->captSqr) + t->key;
+//printf("# capt=%02x vic=%02x slot=%02x\n", f->captSqr, f->victim, handSlot[f->victim]);
+    stm = f->toPiece & COLOR;
+    if(f->victim) DEL_PIECE(SIDE(f->victim), f->captSqr);		// update piece lists (victim can be own piece)
+    if(f->mutation < 0) {
+	ADD_PIECE(SIDE(stm), f->toSqr);
+	if(board[f->fromSqr] == 255) handBits &= ~HAND_BIT(f->toPiece); // dropped the last one of its type
+    } else MOVE_PIECE(SIDE(stm), f->fromSqr, f->toSqr);
+    f->bulk = promoGain[stm+30]; promoGain[stm+30] += handBulk[f->victim] - dropBulk[f->fromSqr];
+    location[f->toPiece] = f->toSqr;
+    checkHist[moveNr+ply+1] = f->checker;
+
+    return 1;
+}
+
+void
+UnMake (StackFrame *f)
+{
+    int to, stm; Transfer *t;
+    board[f->rookSqr] = f->rook;      // restore either pawnCount or (after castling) Rook from-square
+    board[f->toSqr]   = f->savePiece; // put back the regularly captured piece (for castling that captured by Rook)
+    board[f->captSqr] = f->victim;    // differs from toSqr on e.p. (Pawn to-square) and castling, (King to-square) and should be cleared then
+    board[f->fromSqr] = f->fromPiece; //          and the mover
+    t = &transfer[SIDE(f->toPiece)][f->victim]; // take victim out of hand again
+    if(++board[t->slot] == 255) handBits &= ~t->bit;
+    if(f->mutation < 0) handBits |= HAND_BIT(f->toPiece); // dropped piece is back in hand
+    promoGain[(f->toPiece & COLOR)+30] = f->bulk;
+    location[f->fromPiece] = f->fromSqr;
+    // piece lists, in reverse order of MakeMove
+    stm = SIDE(f->toPiece);
+    if(f->mutation < 0) DEL_PIECE(stm, f->toSqr); else MOVE_PIECE(stm, f->toSqr, f->fromSqr);
+    if(f->victim) ADD_PIECE(SIDE(f->victim), f->captSqr);
+    to = f->wholeMove & 255;
+    if(to >= specials && sqr2file[to] >= 8 && sqr2file[to] <= 11) MOVE_PIECE(stm, f->captSqr, f->rookSqr); // castling
+}
+
+int
+Search (int stm, int alpha, int beta, StackFrame *ff, int depth, int reduction, int maxDepth)
+{
+    MoveStack m; StackFrame f; HashEntry *entry, hashData; QSEntry *qsEntry;
+    int oldSP = moveSP, *pvStart = pvPtr, oldLimit = depthLimit, oldAna;
+    int killer1 = killers[ply][0], killer2 = killers[ply][1], hashMove;
+    int bestNr, bestScore, startAlpha, startScore, resultDepth, iterDepth=0, originalReduction = reduction;
+    int hit, found, hashKeyH, ran=0, ipMask=0, qsNode = (depth <= 0);
+    int curEval, anaEval, score, upperScore, minScore = -INF, maxScore = INF;
+    int rootBeta, iterAlpha, aspDelta = 0, aspFail = 0;
+
+    // the move that led here is legal: MoveGen and MakeMove weed out the others, and Legal() vets hash move and killers
+    if(ply > 90) { if(DEBUG) Dump("maxply"); ff->depth = 0; ff->lim = ff->newEval-150; return -ff->newEval+150; }
+    f.xking = location[stm+31]; // opponent King, as stm not yet toggled
+
+
+    // some housekeeping
+    stm ^= COLOR;
+    f.hashKey =  ff->newKey; pathKey[ply] = f.hashKey;
+    f.pstEval = -ff->newEval;
+    f.rights  =  ff->rights | spoiler[ff->toSqr] | spoiler[ff->fromSqr];
+    m.epSqr   =  ff->epSqr; // put in m, because MoveGen needs it
+
+    // hash probe
+    hashKeyH = f.hashKey >> 32;
+    qsEntry = qsTable + (f.hashKey + (stm + 9849 + f.rights)*(m.epSqr + 51451) & QS_HASH-1); // single entry
+    if(qsNode && qsEntry->lock == hashKeyH) hit = 0, found = 1, entry = NULL; // QS hit, no need to look further (QS nodes only store in qsTable)
+    else entry = ProbeHash(f.hashKey, stm, f.rights, m.epSqr, &hit, &hashData), found = hit || qsEntry->lock == hashKeyH; // the tables complement each other
+    if(found) {
+	int score, lim, d, checker;
+	signed char p;
+
+	if(!hit) score = qsEntry->score, lim = qsEntry->lim, d = qsEntry->depth, checker = qsEntry->checker, hashMove = qsEntry->move;
+	else     score = hashData.score, lim = hashData.lim, d = hashData.depth, checker = hashData.checker, hashMove = hashData.move;
+	f.checker = checker; f.checkDist = 0;
+	if(f.checker != CK_NONE) { // in check; restore info needed in evasion test
+	    if(sqr2file[f.checker] != 12) f.checkDir = 0; else { // off-board represents on-board distant check
+		int vec = location[stm+31] - (f.checker -= 11);
+		f.checkDir = deltaVec[vec];
+		f.checkDist = dist[vec];
+	    }
+	    reduction = 0; // checks are not reduced
+	}
+	if(score >= beta || lim <= alpha || score == lim) { // only take hash cuts from fully resolved results, unless they fail low or high
+	    d += (score >= beta & d >= LMR)*reduction; // fail highs need to satisfy reduced depth only, so we fake higher depth than actually found
+	    if((score > alpha && d >= depth || d >= maxDepth) && ply) { // sufficient depth
+		ff->depth = d + 1; ff->lim = -score; return lim; // depth was sufficient, take hash cutoff
+	    }
+	}
+	p = board[hashMove>>8&255];
+	if(hashMove && ((p & stm) == 0 || p == -1 || !Legal(stm, hashMove))) {
+	    if(DEBUG) printf("telluser bad hash move %16llx: %s\n", f.hashKey, MoveToText(hashMove));
+	    hashMove = 0; f.checker = CK_UNKNOWN;
+	}
+    } else hashMove = 0, f.checker = CK_UNKNOWN;
+
+    moveSP += 48;  // create space for non-captures
+
+    if((++nodeCount & 0xFFF) == 0) abortFlag |= TimeIsUp(3); // check time limit every 4K nodes
+    curEval = f.pstEval + Evaluate(stm, f.rights);
+    alpha -= (alpha < curEval); //pre-compensate delayed-loss bonus
+    beta  -= (beta <= curEval);
+    if(ff->checker == CK_NONE) killers[ply+1][0] = killers[ply+1][1] /* = killers[ply+1][2]*/ = 0;
+    else if(ply > 0) killers[ply+1][0] = killers[ply-1][0], killers[ply+1][1] = killers[ply-1][1]; // inherit killers after check+evasion
+    if(-INF >= beta) { moveSP = oldSP; ff->depth = MAXPLY; ff->lim = INF-1; return INF; }
+
+
+    // check test
+    if(f.checker == CK_UNKNOWN) CheckTest(stm, ff, &f); // test for check if hash did not supply it
+    if(f.checker != CK_NONE) {
+	depth++, maxDepth++, reduction = originalReduction = 0 /*, killers[ply][2] = -1*/; // extend check evasions
+    } else if(depth > LMR) {
+	if(depth - reduction < LMR) reduction = depth - LMR; // never reduce to below 'LMR' ply
+	depth -= reduction;
+    } else reduction = originalReduction = 0;
+    checkHist[moveNr+ply+1] = f.checker;
+    oldAna = anaSP; anaSP += (ff->checker != CK_NONE); // node after evasion: accept new analogy
+    anaEval = curEval;
+
+    // stand pat or null move
+    startAlpha = alpha; startScore = -INF; rootBeta = beta;
+    if(depth <= 0) { // QS
+	qsCount++;
+	if(ff->checker != CK_NONE && ff->tpGain > 0) anaEval = 50-INF; // forbid stand pat if horizon check tossed material
+	if(anaEval > alpha) {
+	    if(anaEval >= beta) { ff->depth = 1; ff->lim = -anaEval - (anaEval < curEval); moveSP = oldSP; anaSP = oldAna; return INF; } // stand-pat cutoff
+	    alpha = startScore = anaEval; maxDepth = 0; // we will not fail low, so no extra iterations
+	}
+	if(maxDepth <= 0) {
+	    if(board[toDecode[hashMove&255]] == 0) hashMove = 0;
+#ifdef IDQS
+	    if(ply >= depthLimit) { ff->depth = 1; ff->lim = -anaEval-150; moveSP = oldSP; anaSP = oldAna; return anaEval + 150; } // hit depth limit; give hefty stm bonus
+	    if(depthLimit == MAXPLY) depthLimit = ply+10; // we just entered pure QS; set up depth limit
+#endif
+ 	}
+    } else if(curEval >= beta && f.checker == CK_NONE) {
+	int nullDepth = depth - 3;
+	int eva = (ff->checker != CK_NONE) && !oldAna && nullDepth >= 0; // first evasion in branch, and depth of null-move search was higher before the check
+	nullDepth += eva; // reduce one less than normal after first evasion, to make sure we see same threats after spite check
+	if(nullDepth < 0) nullDepth = 0;
+	f.mutation = -2; // kludge to suppress testing for discovered check
+	f.newEval = f.pstEval;
+	f.newKey = f.hashKey;
+	f.epSqr = -1; f.fromSqr = f.toSqr = f.captSqr = 1; f.toPiece = board[1];
+	deprec[ply] = maxDepth << 16 | depth << 8; path[ply++] = 0;
+	score = -Search(stm, -beta, 1-beta, &f, nullDepth, 0, nullDepth);
+	TRACE(-beta, 1-beta, nullDepth, 255);
+	ply--;
+	if(score >= beta) { ff->depth = f.depth + originalReduction + 3; ff->lim = -beta-1; moveSP = oldSP; anaSP = oldAna; return INF; }
+    }
+
+    // move generation
+    if(MoveGen(stm, &m, f.rights)) { // impossible (except for hash collision giving wrong in-check status)
+	if(DEBUG) Dump("King capture"); ff->depth = MAXPLY; ff->lim = -INF; moveSP = oldSP; anaSP = oldAna; return INF;
+    }
+    if(f.checkDist && maxDepth <= 1) ipMask = SafeIP(&f);
+    if(hashMove) moveStack[--m.firstMove] = hashMove; // put hash move in front of list (duplicat!)
+    if(f.checker != CK_NONE) moveSP = m.drops = m.castlings; // clip off castlings when in check
+    if(ff->checker != CK_NONE) { // last move was evasion; see if we have counter move
+	int move = mateKillers[(ff->wholeMove & 0xFFFF) + (stm - WHITE << 11)];
+	if(move && (move>>16 & 0xFF) == f.xking && (move>>24 & 0xFF) == board[toDecode[move & 0xFF]] && PseudoLegal(stm, move)) { // counter move is pseudo-legal and matches position
+	    moveStack[moveSP++] = moveStack[m.nonCapts]; moveStack[m.nonCapts] = move & 0xFFFF; m.late = ++m.nonCapts; // make room and put with captures (lowest sort key)
+	}
+    }
+
+    if(depth <= 0 && anaEval == curEval) {
+	int bonus = (m.safety + 3*m.hole)*(10 + m.safety + m.hole + promoGain[stm+30] /*- 0*promoGain[COLOR-stm+30]*/) + 15*m.cBonus;
+	bonus += (m.escape < 2 ? 200 - m.escape*100 : 0);
+	if(bonus > 900) bonus = 900; // S4
+	bonus += bonus >> 1;
+	int newEval = curEval + bonus;
+	if(newEval > alpha) {
+	    if(newEval >= beta) { ff->depth = 1; ff->lim = -newEval; moveSP = oldSP; depthLimit = oldLimit; anaSP = oldAna; return INF; } // stand-pat cutoff
+	    alpha = startScore = newEval; maxDepth = 0; // we will not fail low, so no extra iterations
+	}
+   }
+
+  again: // QS IDD loop
+    do { // IID loop
+	int curMove, highDepth, i;
+	iterDepth++;
+	highDepth = (iterDepth > depth ? iterDepth : depth) - 1; // reply depth for high-failing moves
+	if(ply == 0) { // in root we aspire to the score of the previous iteration
+	    alpha = startAlpha; beta = rootBeta;
+	    if(aspDelta) {
+		if(rootScore - aspDelta > alpha) alpha = rootScore - aspDelta;
+		if(rootScore + aspDelta < beta)  beta  = rootScore + aspDelta;
+	    }
+	}
+	iterAlpha = alpha;
+	pvPtr = pvStart; *pvPtr++ = 0; // empty PV
+	bestScore = upperScore = startScore; bestNr = 0; // kludge: points to 0 entry in moveStack
+	resultDepth = MAXPLY;
+	m.stage &= 3;
+	for(curMove=m.firstMove; m.stage<4; curMove++) {
+	    int score;
+
+	    // sort section
+	    if(curMove >= m.unsorted) {
+		if(curMove < m.nonCapts) { // captures: extract best
+		    unsigned int i, bestNr = curMove, bestCapt = moveStack[curMove];
+		    for(i=curMove+1; i<m.nonCapts; i++) if(moveStack[i] > bestCapt) bestCapt = moveStack[bestNr=i]; // find best
+		    moveStack[bestNr] = moveStack[curMove]; moveStack[curMove] = bestCapt; // swap it to front
+		    m.unsorted = curMove + 1; // sorted set now includes move
+		} else {
+		    if(maxDepth <= 0) { 
+			resultDepth = 0; if(upperScore < anaEval) upperScore = anaEval;
+			if(m.stage) break;
+			moveSP = curMove;
+			if(ff->checker != CK_NONE && depthLimit != MAXPLY && oldLimit == MAXPLY) { // last move before QS was evasion
+			    CheckDrops(stm, f.xking); // also do check drops
+			    if(moveSP > curMove) { m.stage = 3; m.unsorted = moveSP; curMove--; continue; }
+			}
+			if(depthLimit == MAXPLY || oldLimit != MAXPLY || checkHist[moveNr+ply-1] == CK_NONE) break;
+			if(killer1 && PseudoLegal(stm, killer1)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer1; // try (possibly inherited) killers
+			if(killer2 && PseudoLegal(stm, killer2)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer2;
+			CheckDrops(stm, f.xking);
+			if(curMove >= moveSP) break;
+			m.stage = 3; m.unsorted = moveSP;
+			curMove--;
+			continue;
+		    } // in QS we stop after captures
+		    switch(m.stage) { // we reached non-captures
+		      case 0:
+			if(f.checker == CK_NONE) { // do not use killers when in check
+			    if(killer1 && PseudoLegal(stm, killer1)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer1; // insert killers
+			    if(killer2 && PseudoLegal(stm, killer2)) moveStack[moveSP++] = moveStack[m.late], moveStack[m.late++] = killer2; // (original goes to end)
+			}
+			m.drops = moveSP;
+			// here we can sort based on history
+			if(moveSP > m.late) qsort(moveStack + m.late, moveSP - m.late, sizeof(int), &HisComp);
+			m.stage = 1; if(moveSP > curMove) break;
+		      case 1:
+			if(f.checker != CK_NONE) {
+			    m.stage |= 4; // when in check we stop after evasion drops
+			    if(f.checkDist == 0) continue; // but there cannot be any for contact/double checks
+			    EvasionDrops(stm, &f, ipMask); // at d <= 1 suppress futile interpositions
+			    if(moveSP <= curMove) continue; // no avail
+			    m.stage = 3; break;
+			}
+			CheckDrops(stm, f.xking);
+			m.stage = 2; if(moveSP > curMove) break;
+		      case 2:
+			if(iterDepth > 1) { // quiet drops only at depth >= 2
+			    m.quiet = moveSP;
+			    AllDrops(stm);
+			    for(i=m.quiet+1; i<moveSP; i++) { // stable insertion sort on drop history (keeps generation order for ties)
+				int move = moveStack[i], h = DROPHIST(move), j = i;
+				while(j > m.quiet && DROPHIST(moveStack[j-1]) < h) moveStack[j] = moveStack[j-1], j--;
+				moveStack[j] = move;
+			    }
+			    m.stage = 3; if(moveSP > curMove) break;
+			}
+		      case 3:
+			m.stage |= 4; continue; // this value of m.stage terminates the loop over moves
+		    }
+		    m.unsorted = moveSP; // set to return here when done with the current list
+		}
+	    }
+
+	    if(ply == 0 && rootOnly && (moveStack[curMove] & 0xFFFF) != rootOnly) continue; // worker searching one root move
+
+	    // self-captures in QS only when the in-hand value could raise alpha (in check we are never in QS)
+	    if(maxDepth <= 0 && curMove < m.nonCapts) {
+		int victim = board[toDecode[moveStack[curMove] & 255]];
+		if(victim & stm && curEval + handValSame[victim] - QS_SELF_GAIN <= alpha) continue;
+	    }
+
+	    // quiet-drop pruning (never in the root or PV nodes); what it skips is only valid for the current iteration,
+	    // and must be assumed to fail low, unless we have a better upper bound
+	    if(curMove >= m.quiet) {
+		int d = iterDepth - 1, n = curMove - m.quiet;
+		unsearched[curMove] = 1; // until we get to search it
+		if(ply && beta == alpha + 1) {
+		    if(n >= DROP_CAP(d)) { // per-node cap reached: done with this node
+			if(iterDepth < resultDepth) resultDepth = iterDepth;
+			if(alpha > upperScore) upperScore = alpha;
+			m.stage |= 4; continue;
+		    }
+		    if(d <= 2) { // at low depth we prune futile and unpromising drops
+			if(curEval + 200*d <= alpha) { // a quiet drop only gives up in-hand value
+			    if(iterDepth < resultDepth) resultDepth = iterDepth;
+			    if(curEval + 200*d > upperScore) upperScore = curEval + 200*d;
+			    m.stage |= 4; continue;
+			}
+			if(n >= 4 + 4*d && DROPHIST(moveStack[curMove]) <= 0) { // move-count pruning
+			    if(iterDepth < resultDepth) resultDepth = iterDepth;
+			    if(alpha > upperScore) upperScore = alpha;
+			    continue;
+			}
+		    }
+		}
+	    }
+
+	    // make move
+	    if(MakeMove(&f, moveStack[curMove])) { // aborts if fails to evade existing check
+
+		// futility pruning of quiet moves and captures alike (not in the root, where a worker may search a single
+		// move with a null window): a capture is futile when even the value of the victim plus the margin falls short
+		if(ply && depth > 0 && iterDepth <= 2 && f.checker == CK_NONE && beta == alpha + 1 && alpha < INF-100) {
+		    int futileScore = curEval + f.newEval - f.pstEval + futilityMargin[iterDepth]; // gain includes handVal of victim
+		    if(futileScore <= alpha) {
+			StackFrame g;
+			CheckTest(stm ^ COLOR, &f, &g);
+			if(g.checker == CK_NONE) { // checking moves are never futile
+			    UnMake(&f);
+			    if(iterDepth < resultDepth) resultDepth = iterDepth; // only futile at this depth
+			    if(futileScore > upperScore) upperScore = futileScore;
+			    continue;
+			}
+		    }
+		}
+
+		// self-capture/redrop cycle: this drop undoes our previous move, so we just lost two tempi
+		if(f.mutation == -1 && ply >= 2 && f.newKey - f.hashKey == pathKey[ply-2] - pathKey[ply-1]) {
+		    UnMake(&f); continue;
+		}
+
+		unsearched[curMove] = 0;
+
+		// repetition checking
+		int index = (unsigned int)f.newKey >> 24 ^ stm << 2; // uses high byte of low (= hands-free) key
+		while(repKey[index] && (repKey[index] ^ (int)f.newKey) & 0xFFFFF) index++;
+		int oldRepKey = repKey[index], oldRepDep = repDep[index];
+		if(oldRepKey && ff->mutation != -2) { // key present in table: (quasi-)repetition
+		    int gain = (f.newEval << 20) - (repKey[index] & 0xFFF00000);
+		    if(gain == 0) { // true repeat
+			score = 0;
+			if(perpLoses) { // repetitions not always draw
+			    int i, d = repDep[index];
+			    for(i=moveNr+ply-1; i>=d; i-=2) if(checkHist[i+1] == CK_NONE) break;
+			    if(i < d) score = -INF; // we deliver a perpetual, so lose
+			    else {
+				for(i=moveNr+ply-2; i>=d; i-=2) if(checkHist[i+1] == CK_NONE) break;
+				if(i < d) score = INF-1; // we are suffering a perpetual, so lose
+				else if(perpLoses == 1) score = (stm == WHITE ? -INF : INF-1); // mini-Shogi, sente loses
+				else if(perpLoses == TORI_NR) score = -INF; // Tori Shogi, repeating loses
+			    }
+			   
+			}
+		    }
+		    else if(gain == pawn  || gain == queen  || gain >= (400<<20)) score = INF-1;  // quasi-repeat with extra piece in hand
+		    else if(gain == -pawn || gain == -queen || gain <= (-400<<20)) score = 1-INF; // or with one piece less
+		    else goto search;// traded one hand piece for another; could still lead somewhere
+		    f.lim = score; f.depth = (score >= beta ? highDepth+1 : iterDepth); // minimum required depth
+		    *pvPtr = 0; // fake that daughter returned empty PV
+		} else { // not a repeat: search it
+		    int lmr;
+		  search:
+		    lmr = 0;
+		    if(curMove >= m.late && f.checker == CK_NONE) { // late quiet move, not an evasion: table-driven reduction
+			int n = curMove - m.late + 1, d = iterDepth - 1, h = history[moveStack[curMove] & 0xFFFF];
+			lmr = lmrTable[d < 31 ? d : 31][n < 63 ? n : 63] + (curMove >= m.drops); // drops get one more
+			lmr += (h == 0) - (h > 4*iterDepth*iterDepth); // moves that never raised alpha reduce more, good ones less
+			if(lmr < 1) lmr = 1;                             // (checking moves are not reduced by the daughter)
+		    }
+		    f.tpGain = f.newEval + ff->pstEval;     // material gain in last two ply
+		    if(ply==0 && randomize && moveNr < 10) ran = (alpha > INF-100 || alpha <-INF+100 ? 0 : (f.newKey*ranKey>>24 & 31)- 16);
+		    repKey[index] = (int)f.newKey & 0xFFFFF | f.newEval << 20; repDep[index] = ply + moveNr; // remember position
+		    // recursion
+		    deprec[ply] = (f.checker != CK_NONE ? f.checker : 0)<<24 | maxDepth<<16 | depth<< 8 | iterDepth; path[ply++] = moveStack[curMove] & 0xFFFF;
+		    if(curMove > m.firstMove && beta > alpha + 1 && depth > 0) { // PVS: later moves get zero window first
+			score = -Search(stm, -alpha-1+ran, -alpha+ran, &f, iterDepth-1, lmr, highDepth);
+			TRACE(-alpha-1+ran, -alpha+ran, iterDepth-1, m.stage);
+			if(score + ran > alpha && score + ran < beta && !abortFlag) { // fail high inside window; re-search to get exact score
+			    score = -Search(stm, -beta, -alpha+ran, &f, iterDepth-1, lmr, highDepth);
+			    TRACE(-beta, -alpha+ran, iterDepth-1, m.stage);
+			}
+		    } else {
+			score = -Search(stm, -beta, -alpha+ran, &f, iterDepth-1, lmr, highDepth);
+			TRACE(-beta, -alpha+ran, iterDepth-1, m.stage);
+		    }
+		    if(ran && score < INF-100 && score > 100-INF) score += ran, f.lim += ran;
+		    ply--;
+
+		    repKey[index] = oldRepKey; repDep[index] = oldRepDep;
+		}
+
+		// unmake
+		UnMake(&f);
+
+	    } else score = f.lim = -INF, f.depth = MAXPLY;
+if(PATH){
+int m=moveStack[curMove];
+printf("%d:%d:%d %2d. %08x %c%d%c%d %6d %6d %6d\n",ply,depth,iterDepth,curMove,m,(m>>8&255)%22+'a',(m>>8&255)/22+1,toDecode[m&255]%22+'a',toDecode[m&255]/22+1,f.pstEval,score,bestScore);
+}
+
+	    if(abortFlag) { moveSP = oldSP; depthLimit = oldLimit; anaSP = oldAna; return -INF; }
+
+	    // minimaxing
+	    if(f.depth < resultDepth) resultDepth = f.depth;
+	    if(f.lim > upperScore) upperScore = f.lim;
+
+	    if(score > bestScore) {
+		bestScore = score;
+		if(score > alpha) {
+		    int *tail;
+		    alpha = score; bestNr = curMove;
+		    history[moveStack[curMove] & 0xFFFF] += iterDepth*iterDepth;
+		    if(f.mutation == -1) DROPHIST(moveStack[curMove]) += iterDepth*iterDepth;
+		    if(score > INF-100 && curMove >= m.nonCapts)
+			mateKillers[(ff->wholeMove & 0xFFFF) + (stm - WHITE << 11)] = moveStack[curMove] & 0xFFFF | f.xking << 16 | board[f.toSqr] << 24; // store mate killers
+		    if(score >= beta) { // beta cutoff
+			if(ply == 0 && beta < rootBeta) { // root fails high on aspiration window; the score is a lower bound
+			    ff->move = moveStack[curMove]; SetRootScore(XboardScore(score)); aspFail = 1; break;
+			}
+			if(f.checker == CK_NONE && curMove >= m.nonCapts && moveStack[curMove] != killers[ply][1])
+			    killers[ply][0] = killers[ply][1], killers[ply][1] = moveStack[curMove];
+			if(curMove > m.quiet) { int i; // quiet drops that were searched before the cut move failed
+			    for(i=m.quiet; i<curMove; i++) if(!unsearched[i]) DROPHIST(moveStack[i]) -= iterDepth;
+			}
+			resultDepth = f.depth;
+			upperScore = INF; goto cutoff; // done with this node
+		    }
+		    tail = pvPtr; pvPtr = pvStart; *pvPtr++ = moveStack[curMove]; // alpha < score < beta: move starts new PV
+		    while(*pvPtr++ = *tail++); // copy PV of daughter node behind it (including 0 sentinel)
+		    if(ply == 0) { // in root we report this PV
+			ReportPV(iterDepth, XboardScore(score), pvStart);
+			ff->move = moveStack[bestNr];
+		    }
+		}
+	    }
+	}   // move loop
+
+	// stalemate correction
+
+	if(ply == 0 && (aspFail || bestScore <= iterAlpha && iterAlpha > startAlpha)) { // root score outside aspiration window
+	    aspDelta = (aspDelta < 1000 ? 4*aspDelta : 0); // widen it (eventually to full window) and repeat iteration
+	    aspFail = 0; iterDepth--;
+	} else {
+	    if(ply == 0) { // next iteration aspires to this score, unless it is a mate score
+		rootScore = bestScore; // (a worker searching one move in a window given by the coordinator must not narrow it)
+		aspDelta = (bestScore > 100-INF && bestScore < INF-100 && startAlpha <= 1-INF && rootBeta >= INF-1 ? ASPIRATION : 0); // (bounds pre-compensated for delayed-loss bonus)
+	    }
+
+	    // self-deepening
+	    if(resultDepth > iterDepth) iterDepth = resultDepth; // unexpectedly deep result (from hashed daughters?)
+	    if(reduction && iterDepth == depth) depth += reduction, originalReduction = reduction = 0; // no fail high, start unreduced re-search on behalf of parent
+	    if(iterDepth >= depth && alpha > startAlpha ) break; // move is PV; nominal depth suffices
+	}
+	alpha = startAlpha; // reset alpha for next iteration
+
+	// put best in front
+	if(bestNr > m.firstMove) {
+	    int bestMove = moveStack[bestNr];
+	    if(bestNr == m.firstMove+1) moveStack[bestNr] = moveStack[m.firstMove]; else m.firstMove--; // swap first two, or prepend duplicat
+	    moveStack[bestNr = m.firstMove] = bestMove;
+	} else m.late += (m.late == bestNr); // if best already in front (or non-existing), just make sure it is not reduced
+
+    } while(iterDepth < maxDepth && (ply || !TimeIsUp(1)));   // IID loop
+
+    if(upperScore == -INF) { // we are mated!
+	if(perpLoses) {     // Shogi
+	    if(ff->fromSqr == handSlot[stm]) bestScore = upperScore = INF; // mated by Pawn drop, so we win!
+	} else if(f.checker == CK_NONE) bestScore = upperScore = 0;        // stalemate in zh is draw
+    }
+
+  cutoff:
+
+#ifdef IDQS
+    if(depthLimit != MAXPLY) { // we are in iteratively deepening QS
+	if(bestScore < minScore) { bestScore = minScore; if(upperScore < bestScore) upperScore = bestScore; } // when we aspired with the previous result, fail high and low must mean score is on edge
+	if(upperScore > maxScore) { upperScore = maxScore; if(upperScore < bestScore) bestScore = upperScore; }
+	if(oldLimit == MAXPLY && bestScore != upperScore && bestScore < beta && upperScore > alpha) { // we are in the root of QS and the score is unresolved
+	    depthLimit+=10; alpha = startScore = curEval; iterDepth = 0; // increase depth limit and search again
+	    goto again;
+	}
+    }
+#endif
+
+    // delayed-loss bonus
+    bestScore += (bestScore < curEval);
+    upperScore += (upperScore < curEval);
+    resultDepth -= (f.checker != CK_NONE); // store unextended depth
+
+    // hash store
+    if(qsNode) {
+	qsEntry->lock = hashKeyH;
+	qsEntry->move = moveStack[bestNr];
+	qsEntry->score = bestScore;
+	qsEntry->lim = upperScore;
+	qsEntry->depth = resultDepth;
+	qsEntry->checker = f.checker + 11*(f.checkDist != 0);
+    } else if(ply || !rootOnly) { // a root that searched one move has no valid upper bound
+	if(!hit) { // replacement
+//	    if(searchNr - entry[-3].age > 2) entry -= 3; else { // replace primary hit if stale
+	    {
+		HashEntry *entry2 = entry - 3;
+		entry2 += (entry2[0].depth > entry2[1].depth);
+		entry -= (entry[0].depth > entry[-1].depth);
+		if(entry->depth > entry2->depth) entry = entry2;
+	    }
+	}
+	hashData = (HashEntry) { 0 };
+	hashData.move = moveStack[bestNr]; // if no move was found, bestNr = 0, and moveStack[0] contains INVALID
+	hashData.score = bestScore;
+	hashData.lim = upperScore;
+	hashData.depth = resultDepth;
+	hashData.flags = (bestScore > alpha)*H_LOWER + (bestScore < beta)*H_UPPER;
+	hashData.checker = f.checker + 11*(f.checkDist != 0); // encode distant check as off-board checker
+	StoreHash(entry, &hashData, hashKeyH); // lock last, for the benefit of other processes
+    }
+
+    // return results
+    moveSP = oldSP; anaSP = oldAna; pvPtr = pvStart; depthLimit = oldLimit;
+    ff->depth = resultDepth + 1 + originalReduction; // report valid depth as seen from parent
+    ff->lim = -bestScore;
+    return upperScore;
+}
+
+int
+Perft (int stm, StackFrame *ff, int depth)
+{   // count the leaf nodes of the move tree; stm is the side that made the last move
+    MoveStack m; StackFrame f;
+    int i, oldSP = moveSP, count = 0;
+
+    if(depth == 0) return 1;
+
+    stm ^= COLOR;
+    f.hashKey = ff->newKey;
+    f.pstEval = -ff->newEval;
+    f.rights  =  ff->rights | spoiler[ff->toSqr] | spoiler[ff->fromSqr];
+    m.epSqr   =  ff->epSqr;
+    if(ply) CheckTest(stm, ff, &f); else RootCheck(stm, &f); // the root can have been set up in check
+    moveSP += 48;
+    if(MoveGen(stm, &m, f.rights)) { moveSP = oldSP; return 0; } // cannot happen, as only legal moves are generated
+    if(f.checker != CK_NONE) moveSP = m.castlings; // no castling out of check
+    AllDrops(stm);
+    for(i=m.firstMove; i<moveSP; i++) if(MakeMove(&f, moveStack[i])) {
+	ply++; count += Perft(stm, &f, depth - 1); ply--;
+	UnMake(&f);
+    }
+    moveSP = oldSP;
+    return count;
+}
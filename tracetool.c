@@ -0,0 +1,83 @@
+/********************************************************************************************/
+/* Offline reader for the search traces the engine writes after the 'trace' command. It     */
+/* rebuilds the tree from the post-order node records, and summarizes where the nodes went. */
+/* Usage: tracetool FILE [DEPTH] (DEPTH > 0 also prints the tree down to that many plies)   */
+/********************************************************************************************/
+
+#define NOMAIN
+#include "dropper.c"
+
+TraceRecord *rec;
+int *parent, *first, nrRecs, top[10];
+
+char *
+Path (int i)
+{ // moves from the oldest recorded ancestor to record i
+  static char buf[MAXPLY*8]; int moves[MAXPLY], n = 0;
+  for(; i >= 0 && rec[i].ply; i = parent[i]) moves[n++] = rec[i].move;
+  for(buf[0] = 0; n-- > 0; ) strcat(buf, moves[n] ? MoveToText(moves[n]) : "null"), strcat(buf, " ");
+  return buf;
+}
+
+int
+Size (int i)
+{ // nodes searched since the record preceding its subtree; 0 = unknown, because that fell out of the ring,
+  // or was a previous search of the traced node (so that the nodes of its siblings are in between)
+  int top = rec[nrRecs-1].ply;
+  return first[i] && (top == 0 || rec[first[i]-1].ply > top) ? rec[i].nodes - rec[first[i]-1].nodes : 0;
+}
+
+void
+PrintTree (int i, int maxPly)
+{
+  static char *bound[] = { "exact?", "lower", "upper", "exact" };
+  int j;
+  printf("%*s%-6s d=%-3d [%6d,%6d] %6d %-6s stage %3d %9d nodes\n", 2*(rec[i].ply - rec[nrRecs-1].ply), "",
+         rec[i].ply ? MoveToText(rec[i].move) : "root", rec[i].depth, rec[i].alpha, rec[i].beta, rec[i].score,
+         bound[rec[i].bound], rec[i].stage, Size(i));
+  if(rec[i].ply - rec[nrRecs-1].ply < maxPly) for(j=first[i]; j<i; j++) if(parent[j] == i) PrintTree(j, maxPly);
+}
+
+int
+main (int argc, char **argv)
+{
+  FILE *f; int header[3], *stack, sp = 0, i, j, maxPly = (argc > 2 ? atoi(argv[2]) : 0);
+  int perPly[MAXPLY+1] = { 0 }, bounds[4] = { 0 }, stages[256] = { 0 };
+  if(argc < 2 || !(f = fopen(argv[1], "rb"))) { printf("usage: tracetool FILE [DEPTH]\n"); return 1; }
+  if(fread(header, sizeof(int), 3, f) != 3 || header[0] != 0x31525444) { printf("%s is not a trace\n", argv[1]); return 1; }
+  nrRecs = header[2];
+  rec = (TraceRecord *) malloc(nrRecs*sizeof(TraceRecord));
+  parent = (int *) malloc(nrRecs*sizeof(int)); first = (int *) malloc(nrRecs*sizeof(int));
+  stack = (int *) malloc(nrRecs*sizeof(int)); // holds all pending siblings, so it can be as wide as the tree
+  if(fread(rec, sizeof(TraceRecord), nrRecs, f) != nrRecs || !nrRecs) { printf("truncated trace\n"); return 1; }
+  fclose(f);
+  EngineInit(); GameInit(variants[header[1]].name); // so MoveToText decodes the moves of that variant
+
+  // children were written before their parent, so the records still on the stack at a lower ply are its children
+  for(i=0; i<nrRecs; i++) {
+    first[i] = i; parent[i] = -1;
+    while(sp && rec[stack[sp-1]].ply > rec[i].ply) j = stack[--sp], parent[j] = i, first[i] = first[j];
+    stack[sp++] = i;
+    perPly[rec[i].ply]++; bounds[rec[i].bound]++; stages[rec[i].stage]++;
+  }
+
+  printf("%d nodes, searched with %u nodes\n", nrRecs, rec[nrRecs-1].nodes - rec[0].nodes);
+  printf("ply   records\n");
+  for(i=0; i<=MAXPLY; i++) if(perPly[i]) printf("%3d %9d\n", i, perPly[i]);
+  printf("bounds: %.1f%% fail low (upper), %.1f%% fail high (lower), %.1f%% exact\n",
+         100.*bounds[H_UPPER]/nrRecs, 100.*bounds[H_LOWER]/nrRecs, 100.*bounds[H_LOWER|H_UPPER]/nrRecs);
+  printf("stage   records\n");
+  for(i=0; i<256; i++) if(stages[i]) printf("%5d %9d%s\n", i, stages[i], i == 255 ? " (null move)" : "");
+
+  // the largest subtrees below the oldest recorded root
+  for(i=0; i<10; i++) top[i] = -1;
+  for(i=0; i<nrRecs; i++) if(parent[i] >= 0 && (top[9] < 0 || Size(i) > Size(top[9]))) {
+    for(j=9; j>0 && (top[j-1] < 0 || Size(top[j-1]) < Size(i)); j--) top[j] = top[j-1];
+    top[j] = i;
+  }
+  printf("largest subtrees\n");
+  for(i=0; i<10 && top[i] >= 0; i++) printf("%9d d=%-3d %s\n", Size(top[i]), rec[top[i]].depth, Path(top[i]));
+
+  if(maxPly > 0) for(i=0; i<nrRecs; i++) if(parent[i] < 0 && rec[i].ply == rec[nrRecs-1].ply) PrintTree(i, maxPly);
+  return 0;
+}